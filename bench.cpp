@@ -0,0 +1,411 @@
+// Microbenchmarks of the pccp hot paths, see bench.sh.
+//
+//     bench [-c <old.csv>] [-t <percent>] [<benchmark> ...]
+//
+// Runs all benchmarks (or the ones named) and writes CSV to stdout:
+//     benchmark,iterations,ns_per_op,mb_per_s
+// With -c the results are compared to an earlier run, a change_percent
+// column is added and the exit code is 1 if a benchmark got slower by more
+// than -t percent (default 10), e.g.
+//     ./bench.exe >base.csv
+//     ...change...
+//     ./bench.exe -c base.csv
+//
+// The serial link is the real TTY (tty.cpp) on a pseudo terminal; the
+// benchmark holds the master side. What the host sends is read from it and,
+// for the chunked upload, answered by a fake device right away, so the
+// host side processing plus the kernel calls of the link are measured.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "tty.h"
+#include "crc.h"
+#include "telemetry.h"
+#include "command.h"
+#include "upload.h"
+#include "expect.h"
+#include "stats.h"
+
+#define BENCH_SIZE      65536       // bytes per operation of the data benchmarks
+#define BENCH_MIN_US    50000       // calibrated run time
+#define BENCH_RUNS      5           // the best one counts
+
+// device side of the link: pty master, answering the chunked upload
+static TTY *tty;
+static int master = -1;
+static bool fakeDevice;             // answer the chunked upload protocol
+
+static struct {
+    enum { D_LINE, D_FRAME, D_EOT } state;
+    unsigned char frame[5 + UPLOAD_MAXCHUNKSIZE + 2];
+    unsigned int length, expected;
+} device;
+
+//-----------------------------------------------------------------------------
+  static void deviceReply(const char *reply)
+//-----------------------------------------------------------------------------
+{
+    if (write(master, reply, strlen(reply)) < 0) {
+        fprintf(stderr, "bench: pty write failed\n");
+        exit(2);
+    }
+}
+
+//-----------------------------------------------------------------------------
+  static void deviceReceive(unsigned char ch)
+//-----------------------------------------------------------------------------
+// start line, chunks and the final EOT; CRCs are not checked
+{
+    char reply[16];
+
+    switch (device.state) {
+        case device.D_LINE:
+            if (device.length == 0 && ch == UPLOAD_STX) {
+                device.state = device.D_FRAME;
+                device.frame[device.length++] = ch;
+            }
+            else if (device.length == 0 && ch == UPLOAD_EOT) {
+                device.state = device.D_EOT;
+                device.length = 1;
+            }
+            else if (ch == '\r') {
+                device.length = 0;
+                deviceReply("{r}");
+            }
+            else device.length++;
+            break;
+
+        case device.D_FRAME:
+            device.frame[device.length++] = ch;
+            if (device.length == 5)
+                device.expected = 7 + (device.frame[3] | device.frame[4] << 8);
+            if (device.length > 5 && device.length == device.expected) {
+                sprintf(reply, "{a%u}", device.frame[1] | device.frame[2] << 8);
+                deviceReply(reply);
+                device.state = device.D_LINE;
+                device.length = 0;
+            }
+            break;
+
+        case device.D_EOT:
+            if (++device.length == 5) {
+                deviceReply("{d0}\r\nEnter your choice\n");
+                device.state = device.D_LINE;
+                device.length = 0;
+            }
+            break;
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+  static unsigned int deviceRead(void)
+//-----------------------------------------------------------------------------
+// take what the host sent, with fakeDevice the device answers it
+// Return value: bytes read
+{
+    unsigned char buf[TTY_TXBUFSIZE];
+    unsigned int total = 0;
+    ssize_t n, i;
+
+    while ((n = read(master, buf, sizeof buf)) > 0) {
+        if (fakeDevice)
+            for (i = 0; i < n; i++) deviceReceive(buf[i]);
+        total += n;
+    }
+    return total;
+}
+
+//-----------------------------------------------------------------------------
+  static void linkWait(void)
+//-----------------------------------------------------------------------------
+// nothing moved: wait until either side of the pty has data, pty data
+// is passed on by the kernel asynchronously
+{
+    struct pollfd fds[2];
+
+    fds[0].fd = master;
+    fds[0].events = POLLIN;
+    fds[1].fd = tty->getHandle();
+    fds[1].events = POLLIN;
+    poll(fds, 2, 10);
+}
+
+
+static unsigned char data[BENCH_SIZE];
+static char fileName[] = "/tmp/bench-XXXXXX";
+static volatile unsigned long sink;     // keeps results from being optimized away
+
+//-----------------------------------------------------------------------------
+  static void ignoreEvent(void *context, const TelemetryEvent& ev)
+//-----------------------------------------------------------------------------
+{
+    sink += ev.type + ev.length;
+}
+
+//-----------------------------------------------------------------------------
+  static void benchCrc(long n)
+//-----------------------------------------------------------------------------
+{
+    while (n-- > 0) sink += crc(data, BENCH_SIZE);
+}
+
+//-----------------------------------------------------------------------------
+  static void benchTelemetry(long n)
+//-----------------------------------------------------------------------------
+// device output as the main loop takes it: TTY::getData() into the parser
+{
+    TelemetryParser parser(ignoreEvent, NULL);
+    unsigned char buf[TTY_RXBUFSIZE];
+    unsigned int got, sent, received;
+    ssize_t w;
+
+    while (n-- > 0) {
+        for (sent = received = 0; received < BENCH_SIZE; received += got) {
+            if (sent < BENCH_SIZE && (w = write(master, data + sent, BENCH_SIZE - sent)) > 0) sent += w;
+            if ((got = tty->getData(buf, sizeof buf)) > 0) parser.feed((const char *)buf, got);
+            else linkWait();
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+  static void benchCommand(long n)
+//-----------------------------------------------------------------------------
+// GUI commands: first and last internal file name, an external file
+{
+    static const char *commands[] = { "banana.jpg", "xmas.jpg", "C:\\Users\\pov\\Pictures\\show.gif" };
+    char name[256];
+    int rotInc;
+
+    while (n-- > 0) sink += parse_command(commands[n % 3], name, &rotInc);
+}
+
+//-----------------------------------------------------------------------------
+  static void benchUpload(long n)
+//-----------------------------------------------------------------------------
+// '&' upload: file read, CRC and framing into the TX ring, up to the
+// device's menu
+{
+    Expect seq(*tty);
+
+    while (n-- > 0) {
+        seq.clear();
+        seq.upload(fileName);
+        seq.start();
+        while (seq.isBusy()) {
+            seq.poll();
+            tty->flush(0);
+            if (deviceRead() == 0 && tty->getPendingCount() > 0) linkWait();
+            seq.feed(EXPECT_MENU, strlen(EXPECT_MENU));     // the device is back at its menu
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+  static void chunkedEvent(void *context, const TelemetryEvent& ev)
+//-----------------------------------------------------------------------------
+// as pccp: upload replies and console text to the sequence
+{
+    if (ev.type && ((Expect *)context)->frame(ev.type, ev.value)) return;
+    if (!ev.type) ((Expect *)context)->feed(ev.text, ev.length);
+    sink += ev.type + ev.length;
+}
+
+//-----------------------------------------------------------------------------
+  static void benchChunked(long n)
+//-----------------------------------------------------------------------------
+// '%' upload against a device that acknowledges every chunk at once
+{
+    Expect seq(*tty);
+    TelemetryParser parser(chunkedEvent, &seq);
+    unsigned char buf[TTY_RXBUFSIZE];
+    unsigned int got;
+    bool moved;
+
+    fakeDevice = true;
+    while (n-- > 0) {
+        device.state = device.D_LINE;
+        device.length = 0;
+        seq.clear();
+        seq.upload(fileName, true);
+        seq.start();
+        while (seq.isBusy()) {
+            seq.poll();
+            tty->flush(0);
+            moved = deviceRead() > 0;
+            while ((got = tty->getData(buf, sizeof buf)) > 0) {
+                parser.feed((const char *)buf, got);
+                moved = true;
+            }
+            if (!moved) linkWait();
+        }
+        if (seq.getResult() != EXPECT_OK) {
+            fprintf(stderr, "bench: chunked upload failed\n");
+            exit(1);
+        }
+    }
+    fakeDevice = false;
+}
+
+
+static const struct Benchmark {
+    const char *name;
+    void (*fn)(long n);
+    unsigned int bytes;             // per operation, 0: no throughput
+} benchmarks[] = {
+    { "crc",        benchCrc,       BENCH_SIZE },
+    { "telemetry",  benchTelemetry, BENCH_SIZE },
+    { "command",    benchCommand,   0 },
+    { "upload",     benchUpload,    BENCH_SIZE },
+    { "chunked",    benchChunked,   BENCH_SIZE },
+};
+#define NBENCHMARKS (int)(sizeof benchmarks / sizeof benchmarks[0])
+
+//-----------------------------------------------------------------------------
+  static double measure(const Benchmark& b, long *iterations)
+//-----------------------------------------------------------------------------
+// Return value: ns per operation, best of BENCH_RUNS runs
+{
+    long long t;
+    long n = 1;
+    double best = 0;
+    int i;
+
+    for (;;) {
+        t = now_us();
+        b.fn(n);
+        t = now_us() - t;
+        if (t >= BENCH_MIN_US) break;
+        n *= 2;
+    }
+    for (i = 0; i < BENCH_RUNS; i++) {
+        t = now_us();
+        b.fn(n);
+        t = now_us() - t;
+        if (i == 0 || t * 1000. / n < best) best = t * 1000. / n;
+    }
+    *iterations = n;
+    return best;
+}
+
+//-----------------------------------------------------------------------------
+  static bool baseline(const char *csv, const char *name, double *ns)
+//-----------------------------------------------------------------------------
+// ns per operation of a benchmark in an earlier result
+{
+    char line[256];
+    FILE *fp = fopen(csv, "r");
+    bool found = false;
+
+    if (fp == NULL) return false;
+    while (!found && fgets(line, sizeof line, fp)) {
+        char *comma = strchr(line, ',');
+        if (comma == NULL || comma - line != (int)strlen(name) || strncmp(line, name, comma - line)) continue;
+        found = sscanf(comma, ",%*d,%lf", ns) == 1;
+    }
+    fclose(fp);
+    return found;
+}
+
+//-----------------------------------------------------------------------------
+  static void usage(void)
+//-----------------------------------------------------------------------------
+{
+    int i;
+
+    fprintf(stderr, "Usage: bench [-c <old.csv>] [-t <percent>] [<benchmark> ...]\n");
+    fprintf(stderr, "Benchmarks:");
+    for (i = 0; i < NBENCHMARKS; i++) fprintf(stderr, " %s", benchmarks[i].name);
+    fprintf(stderr, "\n");
+    exit(2);
+}
+
+//-----------------------------------------------------------------------------
+  int main(int argc, char *argv[])
+//-----------------------------------------------------------------------------
+{
+    const char *compare = NULL;
+    double threshold = 10;
+    bool selected[NBENCHMARKS] = { false };
+    bool any = false, regression = false;
+    FILE *out;
+    int c, i, fd;
+
+    while ((c = getopt(argc, argv, "c:t:")) != -1) {
+        switch (c) {
+            case 'c': compare = optarg; break;
+            case 't': threshold = atof(optarg); break;
+            default:  usage();
+        }
+    }
+    for (; optind < argc; optind++) {
+        for (i = 0; i < NBENCHMARKS && strcmp(benchmarks[i].name, argv[optind]); i++);
+        if (i == NBENCHMARKS) usage();
+        selected[i] = any = true;
+    }
+    if (compare && access(compare, R_OK) != 0) {
+        fprintf(stderr, "bench: %s not found\n", compare);
+        return 2;
+    }
+
+    // console text with a telemetry frame per line, as the device sends it
+    for (i = 0; i < BENCH_SIZE; ) {
+        char line[64];
+        int n = snprintf(line, sizeof line, i % 3 ? "{p%u}{s%u}\r\n" : "Rotation %u {c%u}\r\n", 47000 + i % 900, i);
+        if (i + n > BENCH_SIZE) n = BENCH_SIZE - i;
+        memcpy(data + i, line, n);
+        i += n;
+    }
+    if ((fd = mkstemp(fileName)) < 0 || write(fd, data, BENCH_SIZE) != BENCH_SIZE) {
+        fprintf(stderr, "bench: no temporary file\n");
+        return 2;
+    }
+    close(fd);
+    if ((master = posix_openpt(O_RDWR | O_NOCTTY)) < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        fprintf(stderr, "bench: no pseudo terminal\n");
+        return 2;
+    }
+    fcntl(master, F_SETFL, O_NONBLOCK);
+    tty = new TTY(ptsname(master), 115200);
+
+    // the modules report on stdout: results go to a copy of it, the rest away
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    fflush(stdout);
+    if (out == NULL || (fd = open("/dev/null", O_WRONLY)) < 0) return 2;
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+
+    fprintf(out, compare ? "benchmark,iterations,ns_per_op,mb_per_s,change_percent\n"
+                         : "benchmark,iterations,ns_per_op,mb_per_s\n");
+    for (i = 0; i < NBENCHMARKS; i++) {
+        const Benchmark& b = benchmarks[i];
+        long n;
+        double ns, old;
+
+        if (any && !selected[i]) continue;
+        ns = measure(b, &n);
+        fprintf(out, "%s,%ld,%.1f,", b.name, n, ns);
+        if (b.bytes) fprintf(out, "%.1f", b.bytes * 1000. / ns);
+        if (compare) {
+            fprintf(out, ",");
+            if (baseline(compare, b.name, &old) && old > 0) {
+                fprintf(out, "%+.1f", (ns - old) * 100. / old);
+                if ((ns - old) * 100. / old > threshold) regression = true;
+            }
+        }
+        fprintf(out, "\n");
+        fflush(out);
+    }
+
+    delete tty;
+    close(master);
+    unlink(fileName);
+    if (regression) fprintf(stderr, "bench: slower by more than %.0f%%\n", threshold);
+    return regression ? 1 : 0;
+}
@@ -0,0 +1 @@
+g++ -O2 -Wall -o bench.exe bench.cpp tty.cpp crc.cpp telemetry.cpp command.cpp upload.cpp expect.cpp stats.cpp
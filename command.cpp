@@ -3,22 +3,21 @@
 #include <string.h>
 #include <unistd.h>
 #include <ctype.h>      // tolower()
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 #include "command.h"
+#include "stats.h"
 
-//-----------------------------------------------------------------------------
-    int check_command_file(char *filename, int *rotInc)
-//-----------------------------------------------------------------------------
-// Return value n:
-//      n=0: no command file available
-//      n<0: file name is returned in filename
-//      n>0: internal GIF file #n
-//      
-{
-    const struct GifFile {
+// internal GIF pictures of the device, in the order of their index
+static const struct GifFile {
     const char *name;
     const int rotinc;
-	const int rotval;
-    } gifFiles[] = {
+    const int rotval;
+} gifFiles[] = {
     { "banana.jpg",              0, 10 },
     { "candle.jpg",              0, 10 },
     { "couple.jpg",              0, 10 },
@@ -45,34 +44,29 @@
     { "wallbash.jpg",            0, 10 },
     { "xmas.jpg",                0, 10 },    
     { "",                        0, 0  }};
-    
+
+
+//-----------------------------------------------------------------------------
+    int parse_command(const char *command, char *filename, int *rotInc)
+//-----------------------------------------------------------------------------
+// One command as the GUI writes it: an internal file name or a Windows
+// path "X:\...". Same return contract as check_command_file().
+{
     int i;
-    char tmp_filename[256];
-    FILE *fp = fopen(CCF_COMMANDFILE, "r");
-    if (fp==NULL) return CCF_ERROR;
-    i = fscanf(fp, "%s", tmp_filename);
-    if (i!=1) {
-        fclose(fp);
-        return CCF_ERROR;
-    }
-    
+
     // check for internal file name
     for (i=0; i<25; i++) 
     {
-        if (strcmp(gifFiles[i].name, tmp_filename)==0) 
+        if (strcmp(gifFiles[i].name, command)==0) 
         {
             *rotInc = gifFiles[i].rotinc;
-            fclose(fp);
-            unlink(CCF_COMMANDFILE);
             return i;
         }
     }
-    fclose(fp);
-    unlink(CCF_COMMANDFILE);
     // convert to linux file name
-    if (tmp_filename[1] != ':') return CCF_ERROR;
-    if (tmp_filename[2] != '\\') return CCF_ERROR;
-    sprintf(filename, "/cygdrive/%c/%s", tolower(tmp_filename[0]), tmp_filename+3);
+    if (command[1] != ':') return CCF_ERROR;
+    if (command[2] != '\\') return CCF_ERROR;
+    sprintf(filename, "/cygdrive/%c/%s", tolower(command[0]), command+3);
     
     for (i=0; filename[i]; i++) {
         if (filename[i] == '\\') filename[i]='/';
@@ -80,6 +74,130 @@
     return CCF_EXTERNAL_GIF;
 }
 
+
+//-----------------------------------------------------------------------------
+    int check_command_file(char *filename, int *rotInc)
+//-----------------------------------------------------------------------------
+// Return value n:
+//      n=0: no command file available
+//      n<0: file name is returned in filename
+//      n>0: internal GIF file #n
+//      
+{
+    int i;
+    char tmp_filename[256];
+    FILE *fp = fopen(CCF_COMMANDFILE, "r");
+    if (fp==NULL) return CCF_ERROR;
+    i = fscanf(fp, "%s", tmp_filename);
+    fclose(fp);
+    if (i!=1) return CCF_ERROR;
+    unlink(CCF_COMMANDFILE);
+    return parse_command(tmp_filename, filename, rotInc);
+}
+
+
+//-----------------------------------------------------------------------------
+  CommandWatcher::CommandWatcher(void)
+//-----------------------------------------------------------------------------
+{
+    handle = -1;
+    nextCheck = 0;
+    lastSize = lastMtime = -1;
+    pending = true;             // a command may have been dropped before start
+    latency = 0.;
+
+#ifdef __linux__
+    // watch the directory: the GUI creates and deletes the file itself
+    char dir[256];
+    char *slash;
+    strcpy(dir, CCF_COMMANDFILE);
+    slash = strrchr(dir, '/');
+    if (slash) *slash = 0;
+
+    handle = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (handle >= 0 && inotify_add_watch(handle, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        printf("Cannot watch %s (%s) - polling command file\n", dir, strerror(errno));
+        close(handle);
+        handle = -1;
+    }
+#endif
+}
+
+//-----------------------------------------------------------------------------
+  CommandWatcher::~CommandWatcher(void)
+//-----------------------------------------------------------------------------
+{
+    if (handle >= 0) close(handle);
+}
+
+//-----------------------------------------------------------------------------
+  int CommandWatcher::getTimeout(void)
+//-----------------------------------------------------------------------------
+// Return value: poll() timeout in ms until check() has to be called again,
+// -1 if check() only needs to be called when getHandle() is readable
+{
+    long long t;
+    if (pending) return 0;
+    if (handle >= 0) return -1;
+    t = nextCheck - now_ms();
+    return t < 0 ? 0 : (int)t;
+}
+
+//-----------------------------------------------------------------------------
+  int CommandWatcher::check(char *filename, int *rotInc)
+//-----------------------------------------------------------------------------
+// Same return contract as check_command_file(). Never blocks.
+{
+    struct stat st;
+    struct timespec now;
+    long long mtime;
+    int i;
+
+#ifdef __linux__
+    if (handle >= 0) {
+        char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+        const char *name = strrchr(CCF_COMMANDFILE, '/') + 1;
+        ssize_t n;
+
+        while ((n = read(handle, buf, sizeof buf)) > 0) {
+            for (char *p = buf; p < buf + n; ) {
+                struct inotify_event *ev = (struct inotify_event *) p;
+                if (ev->len && strcmp(ev->name, name) == 0) pending = true;
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+        if (!pending) return CCF_ERROR;
+    }
+    else
+#endif
+    {
+        long long t = now_ms();
+        if (!pending && t < nextCheck) return CCF_ERROR;
+        nextCheck = t + CCF_CHECK_INTERVAL_MS;
+    }
+    pending = false;
+
+    if (stat(CCF_COMMANDFILE, &st) != 0) {
+        lastSize = lastMtime = -1;
+        return CCF_ERROR;
+    }
+    mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    if (handle < 0 && (st.st_size != lastSize || mtime != lastMtime)) {
+        // polling: the GUI may still be writing, wait until it is stable
+        lastSize = st.st_size;
+        lastMtime = mtime;
+        return CCF_ERROR;
+    }
+    lastSize = lastMtime = -1;
+
+    i = check_command_file(filename, rotInc);
+    if (i != CCF_ERROR) {
+        clock_gettime(CLOCK_REALTIME, &now);
+        latency = ((long long)now.tv_sec * 1000000000LL + now.tv_nsec - mtime) / 1e6;
+    }
+    return i;
+}
+
 #if 0
 int main(void)
 {
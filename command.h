@@ -1,5 +1,33 @@
 int check_command_file(char *filename, int *rotInc);
+int parse_command(const char *command, char *filename, int *rotInc);
 
 #define CCF_ERROR (-1)
 #define CCF_EXTERNAL_GIF (-2)
-#define CCF_COMMANDFILE "/cygdrive/h/pov-cylinder.txt"
\ No newline at end of file
+#define CCF_COMMANDFILE "/cygdrive/h/pov-cylinder.txt"
+#define CCF_CHECK_INTERVAL_MS 50
+
+//-----------------------------------------------------------------------------
+  class CommandWatcher
+//-----------------------------------------------------------------------------
+// Watches the GUI command file. Under Linux an inotify descriptor reports
+// when the file has been closed after writing, so the main loop can sleep
+// in poll() until the GUI really dropped a command. Elsewhere (CYGWIN has
+// no kernel change notification) the file is stat()ed every
+// CCF_CHECK_INTERVAL_MS and only read once it stopped changing.
+{
+  private:
+    int handle;                 // inotify descriptor or -1 when polling
+    long long nextCheck;        // next stat() time in ms (polling mode)
+    long long lastSize;         // size/mtime seen at the previous stat()
+    long long lastMtime;
+    bool pending;               // check the file without waiting for an event
+    double latency;             // ms from file write to command detection
+
+  public:
+     CommandWatcher(void);
+    ~CommandWatcher(void);
+     int getHandle(void) { return handle; };
+     int getTimeout(void);
+     int check(char *filename, int *rotInc);
+     double getLatency(void) { return latency; };
+};
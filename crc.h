@@ -0,0 +1,21 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <stddef.h>
+
+// CRC-16-CCITT (polynomial 0x1021, seed 0, no final xor) of uploaded files.
+// Streams are handled with crc_init() / crc_update() / crc_finish():
+//     unsigned short c = crc_init();
+//     c = crc_update(c, chunk1, n1);
+//     c = crc_update(c, chunk2, n2);
+//     c = crc_finish(c);              // == crc(whole, n1+n2)
+
+unsigned short crc(unsigned char *data, size_t length);
+
+unsigned short crc_init(void);
+unsigned short crc_update(unsigned short crcValue, const unsigned char *data, size_t length);
+unsigned short crc_finish(unsigned short crcValue);
+
+bool crc_file(const char *fileName, unsigned short *crcValue, size_t *size);
+
+#endif
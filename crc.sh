@@ -0,0 +1 @@
+g++ -O2 -Wall -DCRC_SELFTEST -o crc.exe crc.cpp
@@ -0,0 +1,40 @@
+#include "device.h"
+
+
+//-----------------------------------------------------------------------------
+  void DeviceState::forget(void)
+//-----------------------------------------------------------------------------
+{
+    fileKnown = false;
+    rotationIncrement = -1;
+    atMenu = false;
+}
+
+
+//-----------------------------------------------------------------------------
+  void DeviceState::keyTyped(char ch)
+//-----------------------------------------------------------------------------
+// keys typed by the user go to the device unseen by the model
+{
+    atMenu = false;
+    if (ch == 's' || ch == 'y') rotationIncrement = -1;    // 'y' sets that of the picture
+    if (ch == 'f') fileKnown = false;                       // an upload may follow
+}
+
+
+//-----------------------------------------------------------------------------
+  bool DeviceState::hasFile(unsigned short crc, size_t size)
+//-----------------------------------------------------------------------------
+{
+    return fileKnown && fileCrc == crc && fileSize == size;
+}
+
+
+//-----------------------------------------------------------------------------
+  void DeviceState::fileStored(unsigned short crc, size_t size)
+//-----------------------------------------------------------------------------
+{
+    fileKnown = true;
+    fileCrc = crc;
+    fileSize = size;
+}
@@ -0,0 +1,41 @@
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include <stddef.h>
+
+// Host side model of the POV cylinder's state.
+//
+// The device cannot be asked what it holds, so pccp remembers what it did:
+// the GIF file stored for the 'x' playback, the rotation increment set
+// with 's' ('y' brings the one of its picture) and whether the device sits in its menu. Command sequences skip
+// the steps the device does not need, e.g. showing the file that is already
+// stored only costs the 'x'. The model starts out unknown on every start of
+// pccp and is forgotten whenever the device may have changed behind pccp's
+// back: a sequence failed or timed out (the device may have reset), it was
+// cancelled, or the user typed to the device. The next sequence then does
+// all steps again, which brings the model back in line with the device.
+
+//-----------------------------------------------------------------------------
+  class DeviceState
+//-----------------------------------------------------------------------------
+{
+  private:
+    bool fileKnown;
+    unsigned short fileCrc;         // source file of the stored GIF (before -z)
+    size_t fileSize;
+    int rotationIncrement;          // -1: unknown
+    bool atMenu;
+
+  public:
+    DeviceState(void) { forget(); };
+    void forget(void);
+    void keyTyped(char ch);
+    bool hasFile(unsigned short crc, size_t size);
+    void fileStored(unsigned short crc, size_t size);
+    bool hasRotationIncrement(int increment) { return rotationIncrement == increment; };
+    void rotationIncrementSet(int increment) { rotationIncrement = increment; };
+    bool isAtMenu(void) { return atMenu; };
+    void sequenceDone(void) { atMenu = true; };
+};
+
+#endif
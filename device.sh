@@ -0,0 +1,29 @@
+# Test of the device model (device.h) against povsim: the first '&' upload
+# arrives with a corrupted byte and the device answers "CRC error". pccp must
+# not take the file as stored, so the next show of the same file uploads it
+# again; after that good upload the following show needs none.
+g++ -g -Wall -o pccp.exe pccp.cpp tty.cpp motor.cpp command.cpp crc.cpp upload.cpp telemetry.cpp recorder.cpp stats.cpp gif.cpp playlist.cpp expect.cpp device.cpp server.cpp stream.cpp tune.cpp preflight.cpp || exit 1
+g++ -g -Wall -o povsim.exe povsim.cpp crc.cpp -lpthread -lm || exit 1
+
+# 1x1 GIF, shown twice in a row
+printf 'GIF89a\001\000\001\000\200\000\000\377\377\377\000\000\000!\371\004\001\000\000\000\000,\000\000\000\000\001\000\001\000\000\002\002D\001\000;' > device-test.gif
+printf '1 device-test.gif\n1 device-test.gif\n' > device-test.txt
+
+./povsim.exe -C 1 > device-povsim.log &
+sim=$!
+sleep 1
+dev=$(sed -n 's/^POV cylinder simulator on //p' device-povsim.log)
+timeout 8 ./pccp.exe -t "$dev" -l device-test.txt < /dev/null > device-pccp.log
+kill $sim
+
+failed=$(grep -c "Upload failed - the device answered CRC error" device-pccp.log)
+uploads=$(grep -c "Downloading file" device-pccp.log)
+held=$(grep -c "Device already holds" device-pccp.log)
+rm -f device-test.gif device-test.txt
+if [ "$failed" -eq 1 ] && [ "$uploads" -eq 2 ] && [ "$held" -ge 1 ]; then
+    echo "device.sh: ok"
+    rm -f device-povsim.log device-pccp.log
+else
+    echo "device.sh: FAILED - $failed CRC errors, $uploads uploads, $held skipped (expected 1, 2, 1 or more), see device-pccp.log"
+    exit 1
+fi
@@ -0,0 +1,505 @@
+#include <stdio.h>      // standard input / output functions
+#include <stdlib.h>
+#include <string.h>     // string function definitions
+#include <sys/stat.h>   // fstat()
+
+#include "expect.h"
+#include "tty.h"
+#include "crc.h"
+#include "telemetry.h"
+
+#define UPLOAD_CHUNK 1024       // bytes queued per step while the TX ring has room
+
+// console text of the device after an '&' upload, the first one is success
+// the device is back at its menu when it has taken an upload, an error
+// reply in front of the menu fails it
+static const char *uploadReplies[] = { EXPECT_MENU, "CRC error\n", "Download timeout\n" };
+
+
+//-----------------------------------------------------------------------------
+  Expect::Expect(TTY& tty, const char *tag) : bt(tty), tag(tag), chunkedUpload(tty, tag)
+//-----------------------------------------------------------------------------
+{
+    nSteps = 0;
+    pos = 0;
+    result = EXPECT_OK;
+    done = NULL;
+    doneContext = NULL;
+    fp = NULL;
+    uploadData = NULL;
+    uploading = false;
+    uploadSent = false;
+}
+
+
+//-----------------------------------------------------------------------------
+  Expect::~Expect(void)
+//-----------------------------------------------------------------------------
+{
+    if (fp) fclose(fp);
+}
+
+
+//-----------------------------------------------------------------------------
+  void Expect::clear(void)
+//-----------------------------------------------------------------------------
+// start setting up a new sequence; a running one is cancelled
+{
+    cancel();
+    nSteps = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+  Expect::Step *Expect::add(StepType type)
+//-----------------------------------------------------------------------------
+{
+    Step *s;
+
+    if (nSteps == EXPECT_MAXSTEPS) {
+        printf("Expect: more than %d steps in a sequence\n", EXPECT_MAXSTEPS);
+        exit(1);
+    }
+    s = &steps[nSteps++];
+    memset(s, 0, sizeof *s);
+    s->type = type;
+    return s;
+}
+
+
+//-----------------------------------------------------------------------------
+  void Expect::send(const char *text)
+//-----------------------------------------------------------------------------
+{
+    Step *s = add(STEP_SEND);
+    strncpy(s->text, text, sizeof s->text - 1);
+    s->length = strlen(s->text);
+}
+
+
+//-----------------------------------------------------------------------------
+  void Expect::sendChar(char ch)
+//-----------------------------------------------------------------------------
+{
+    Step *s = add(STEP_SEND);
+    s->text[0] = ch;
+    s->length = 1;
+}
+
+
+//-----------------------------------------------------------------------------
+  void Expect::expect(const char *pattern, Histogram *hist, int timeout_ms, int retries)
+//-----------------------------------------------------------------------------
+{
+    Step *s = add(STEP_EXPECT);
+    strncpy(s->text, pattern, sizeof s->text - 1);
+    s->length = strlen(s->text);
+    s->hist = hist;
+    s->timeout_ms = timeout_ms;
+    s->retries = retries;
+}
+
+
+//-----------------------------------------------------------------------------
+  void Expect::delay(int ms)
+//-----------------------------------------------------------------------------
+{
+    add(STEP_DELAY)->timeout_ms = ms;
+}
+
+
+//-----------------------------------------------------------------------------
+  void Expect::upload(const char *fileName, bool chunked)
+//-----------------------------------------------------------------------------
+// '&' format: '&', size (4 bytes little endian), data, CRC (2 bytes).
+// The file is queued in pieces whenever the TX ring has room.
+// chunked: the '%' format (upload.h), '&' if the device does not know it
+{
+    Step *s = add(STEP_UPLOAD);
+    strncpy(s->text, fileName, sizeof s->text - 1);
+    s->chunked = chunked;
+}
+
+
+//-----------------------------------------------------------------------------
+  void Expect::upload(const char *name, const unsigned char *data, size_t size, bool chunked)
+//-----------------------------------------------------------------------------
+// file in memory, it has to stay unchanged until the sequence is over;
+// name: for messages
+{
+    Step *s = add(STEP_UPLOAD);
+    strncpy(s->text, name, sizeof s->text - 1);
+    s->data = data;
+    s->size = size;
+    s->chunked = chunked;
+}
+
+
+//-----------------------------------------------------------------------------
+  void Expect::action(ExpectAction fn, void *context)
+//-----------------------------------------------------------------------------
+{
+    Step *s = add(STEP_ACTION);
+    s->action = fn;
+    s->context = context;
+}
+
+
+//-----------------------------------------------------------------------------
+  void Expect::start(ExpectDone done, void *context)
+//-----------------------------------------------------------------------------
+{
+    cancel();
+    this->done = done;
+    doneContext = context;
+    result = EXPECT_BUSY;
+    pos = 0;
+    retriesLeft = -1;
+    enter();
+}
+
+
+//-----------------------------------------------------------------------------
+  void Expect::cancel(void)
+//-----------------------------------------------------------------------------
+{
+    if (result == EXPECT_BUSY) finish(EXPECT_CANCELLED);
+}
+
+
+//-----------------------------------------------------------------------------
+  void Expect::finish(ExpectResult r)
+//-----------------------------------------------------------------------------
+{
+    if (fp) {
+        fclose(fp);
+        fp = NULL;
+    }
+    chunkedUpload.cancel();
+    uploading = false;
+    uploadSent = false;
+    uploadData = NULL;
+    result = r;
+    if (done) done(doneContext, r);
+}
+
+
+//-----------------------------------------------------------------------------
+  void Expect::enter(void)
+//-----------------------------------------------------------------------------
+// execute steps until one has to wait for the device or the clock
+{
+    while (result == EXPECT_BUSY) {
+        if (pos == nSteps) {
+            finish(EXPECT_OK);
+            return;
+        }
+        Step *s = &steps[pos];
+        stepStart = now_us();
+        switch (s->type) {
+            case STEP_SEND:
+                bt.putData((unsigned char *)s->text, s->length);
+                pos++;
+                break;
+
+            case STEP_EXPECT:
+                matchPos = 0;
+                deadline = stepStart / 1000 + s->timeout_ms;
+                if (retriesLeft < 0) {
+                    for (resendPos = pos; resendPos > 0 && steps[resendPos-1].type == STEP_SEND; resendPos--);
+                    retriesLeft = resendPos < pos ? s->retries : 0;
+                }
+                return;
+
+            case STEP_DELAY:
+                deadline = stepStart / 1000 + s->timeout_ms;
+                return;
+
+            case STEP_UPLOAD:
+                if (s->chunked) {
+                    if (s->data) uploading = chunkedUpload.begin(s->text, s->data, s->size);
+                    else uploading = chunkedUpload.begin(s->text);
+                    if (uploading) uploadCheck();
+                    else finish(EXPECT_FAILED);
+                }
+                else if (uploadBegin(s)) uploadContinue();
+                else finish(EXPECT_FAILED);
+                return;
+
+            case STEP_ACTION:
+                if (!s->action(s->context)) {
+                    finish(EXPECT_FAILED);
+                    return;
+                }
+                pos++;
+                break;
+        }
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+  void Expect::feed(const char *text, unsigned int length)
+//-----------------------------------------------------------------------------
+// console text from the device; text that arrives while no expect step
+// is waiting is not kept
+{
+    unsigned int i;
+
+    for (i = 0; i < length && result == EXPECT_BUSY; i++) {
+        Step *s = &steps[pos];
+        if (s->type == STEP_UPLOAD && uploadSent) {
+            uploadReply(text[i]);
+            continue;
+        }
+        if (s->type != STEP_EXPECT) break;
+        if (text[i] == s->text[matchPos]) matchPos++;
+        else matchPos = text[i] == s->text[0];
+        if (matchPos == s->length) {
+            if (s->hist) s->hist->record(now_us() - stepStart);
+            retriesLeft = -1;
+            pos++;
+            enter();    // the rest of the text belongs to the next expect step
+        }
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+  bool Expect::frame(char header, unsigned long value)
+//-----------------------------------------------------------------------------
+// in-band frame from the device
+// Return value: true if it was a reply to the running chunked upload
+{
+    if (!uploading || !strchr("rand", header)) return false;
+    chunkedUpload.reply(header, value);
+    uploadCheck();
+    return true;
+}
+
+
+//-----------------------------------------------------------------------------
+  void Expect::poll(void)
+//-----------------------------------------------------------------------------
+// call once per main loop pass: timeouts, delays and uploads
+{
+    if (result != EXPECT_BUSY) return;
+    Step *s = &steps[pos];
+    if (s->type == STEP_UPLOAD) {
+        if (uploading) {
+            chunkedUpload.poll();
+            uploadCheck();
+        }
+        else if (!uploadSent) uploadContinue();
+        else if (now_ms() >= deadline) {
+            printf("\n%sNo menu from the device after the upload - command sequence aborted\n", tag);
+            finish(EXPECT_TIMEOUT);
+        }
+        return;
+    }
+    if (now_ms() < deadline) return;
+    if (s->type == STEP_DELAY) {
+        pos++;
+        enter();
+        return;
+    }
+    if (retriesLeft > 0) {
+        retriesLeft--;
+        printf("\n%sNo answer from the device after %d ms - sending again\n", tag, s->timeout_ms);
+        pos = resendPos;
+        enter();
+        return;
+    }
+    printf("\n%sNo answer from the device after %d ms - command sequence aborted\n", tag, s->timeout_ms);
+    finish(EXPECT_TIMEOUT);
+}
+
+
+//-----------------------------------------------------------------------------
+  int Expect::getTimeout(void)
+//-----------------------------------------------------------------------------
+// Return value: ms until poll() has something to do, -1: nothing to wait for
+{
+    long long t;
+
+    if (result != EXPECT_BUSY) return -1;
+    if (steps[pos].type == STEP_UPLOAD) {
+        if (uploading) return chunkedUpload.getTimeout();
+        // a filled TX ring wakes the main loop with POLLOUT
+        if (!uploadSent) return bt.getPendingCount() > 0 ? -1 : 0;
+    }
+    t = deadline - now_ms();
+    return t > 0 ? (int)t : 0;
+}
+
+
+//-----------------------------------------------------------------------------
+  ExpectResult Expect::run(TelemetryParser& parser)
+//-----------------------------------------------------------------------------
+// start the sequence and drive it to its end without the main loop
+{
+    unsigned char data[TTY_RXBUFSIZE];
+    unsigned int n;
+
+    start();
+    while (result == EXPECT_BUSY) {
+        int timeout = getTimeout();
+        bt.flush(0);
+        int c = bt.getChar(timeout >= 0 && timeout < 100 ? timeout : 100);
+        if (c >= 0) {
+            char ch = c;
+            parser.feed(&ch, 1);
+            n = bt.getData(data, sizeof data);
+            parser.feed((char *)data, n);
+            fflush(stdout);
+        }
+        poll();
+    }
+    return result;
+}
+
+
+//-----------------------------------------------------------------------------
+  bool Expect::uploadBegin(Step *s)
+//-----------------------------------------------------------------------------
+{
+    const unsigned long long MAXFILESIZE = 0xFFFFFFFFULL; // 4 byte size field
+    unsigned char header[5];
+    struct stat st;
+
+    uploadData = s->data;
+    if (uploadData) st.st_size = s->size;
+    else {
+        fp = fopen(s->text, "rb");
+        if (fp==NULL) {
+            printf("Command aborted - File '%s' not found\n", s->text);
+            return false;
+        }
+        if (fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode)) st.st_size = 0;
+    }
+    if (st.st_size == 0) {
+        printf("Command aborted - Error reading file\n");
+        return false;
+    }
+    if ((unsigned long long)st.st_size > MAXFILESIZE) {
+        printf("Command aborted - Files size is greater than %llu bytes\n", MAXFILESIZE);
+        return false;
+    }
+    remaining = st.st_size;
+    printf("%sDownloading file %s - %lu bytes\n", tag, s->text, (unsigned long)remaining);
+    header[0] = '&';
+    header[1] = remaining;
+    header[2] = remaining >> 8;
+    header[3] = remaining >> 16;
+    header[4] = remaining >> 24;
+    bt.putData(header, 5);
+    crcValue = crc_init();
+    readError = false;
+    uploadSent = false;
+    return true;
+}
+
+
+//-----------------------------------------------------------------------------
+  void Expect::uploadContinue(void)
+//-----------------------------------------------------------------------------
+// queue as much of the file as the TX ring takes without waiting
+{
+    unsigned char chunk[UPLOAD_CHUNK];
+    size_t n;
+
+    while (remaining > 0 && bt.getPendingCount() + UPLOAD_CHUNK <= TTY_TXBUFSIZE) {
+        if (uploadData) {
+            n = remaining < UPLOAD_CHUNK ? remaining : UPLOAD_CHUNK;
+            crcValue = crc_update(crcValue, uploadData, n);
+            bt.putData((unsigned char *)uploadData, n);
+            uploadData += n;
+            remaining -= n;
+            continue;
+        }
+        n = fread(chunk, 1, remaining < UPLOAD_CHUNK ? remaining : UPLOAD_CHUNK, fp);
+        if (n == 0) {
+            // the size is already on the wire: pad and send a CRC the
+            // device is guaranteed to reject
+            if (!readError) printf("Error reading file - upload will fail CRC check\n");
+            readError = true;
+            n = remaining < UPLOAD_CHUNK ? remaining : UPLOAD_CHUNK;
+            memset(chunk, 0, n);
+        }
+        crcValue = crc_update(crcValue, chunk, n);
+        bt.putData(chunk, n);
+        remaining -= n;
+    }
+    if (remaining > 0 || bt.getPendingCount() + 2 > TTY_TXBUFSIZE) return;
+
+    if (readError) crcValue ^= 0xFFFF;
+    crcValue = crc_finish(crcValue);
+    chunk[0] = crcValue;
+    chunk[1] = crcValue >> 8;
+    bt.putData(chunk, 2);
+    printf("%sCRC: 0x%04X\n", tag, crcValue);
+    if (fp) fclose(fp);
+    fp = NULL;
+    uploadData = NULL;
+
+    // the TX ring and the driver buffer still have to go out before the
+    // device can answer
+    uploadSent = true;
+    memset(replyMatch, 0, sizeof replyMatch);
+    deadline = now_ms() + EXPECT_TIMEOUT_MS + (bt.getPendingCount() + TTY_TXBUFSIZE) * 10000LL / bt.getBaudRate();
+}
+
+
+//-----------------------------------------------------------------------------
+  void Expect::uploadReply(char ch)
+//-----------------------------------------------------------------------------
+// console text after an upload: the step is over when the device is back
+// at its menu, an error reply fails the sequence
+{
+    unsigned int k;
+
+    for (k = 0; k < sizeof uploadReplies / sizeof uploadReplies[0]; k++) {
+        const char *reply = uploadReplies[k];
+        if (ch == reply[replyMatch[k]]) replyMatch[k]++;
+        else replyMatch[k] = ch == reply[0];
+        if (reply[replyMatch[k]] != 0) continue;
+        uploadSent = false;
+        if (k == 0) {
+            pos++;
+            enter();
+        }
+        else {
+            printf("\n%sUpload failed - the device answered %s", tag, reply);
+            finish(EXPECT_FAILED);
+        }
+        return;
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+  void Expect::uploadCheck(void)
+//-----------------------------------------------------------------------------
+// the chunked upload is over: next step, '&' format or failed
+{
+    switch (chunkedUpload.getResult()) {
+        case UPLOAD_BUSY:
+            return;
+        case UPLOAD_OK:
+            // as with '&': over when the device is back at its menu
+            uploading = false;
+            uploadSent = true;
+            memset(replyMatch, 0, sizeof replyMatch);
+            deadline = now_ms() + EXPECT_TIMEOUT_MS;
+            return;
+        case UPLOAD_NOT_SUPPORTED:
+            uploading = false;
+            printf("%sDevice does not support chunked uploads - using '&' format\n", tag);
+            if (uploadBegin(&steps[pos])) uploadContinue();
+            else finish(EXPECT_FAILED);
+            return;
+        default:
+            finish(EXPECT_FAILED);
+            return;
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef EXPECT_H
+#define EXPECT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "upload.h"
+
+// Non-blocking command sequences for the device console ("expect" style).
+//
+// A sequence is a list of steps that is set up first and then started:
+//     expect.clear();
+//     expect.send("s");
+//     expect.expect(EXPECT_PROMPT);
+//     expect.send("1\r");
+//     expect.expect(EXPECT_MENU);
+//     expect.start(done, context);
+// From then on the main loop drives it: console text goes to feed(),
+// poll() runs timers and uploads, getTimeout() tells poll() when to wake up.
+// Nothing blocks, so keys, motor and telemetry are served while a sequence
+// runs. The in-band frames of a chunked upload go to frame(). An expect step that times out sends the send steps in front of it
+// again if it has retries left - only use them for input the device can
+// take twice, e.g. CR in the menu - then the sequence fails. cancel() stops
+// it at any time.
+// run() starts a sequence and drives it to its end on its own, e.g. before
+// the main loop.
+
+#define EXPECT_MAXSTEPS     32
+#define EXPECT_PROMPT       "]: "       // device asks for a number
+#define EXPECT_MENU         "ce\n"      // end of menu "...choice\n"
+#define EXPECT_TIMEOUT_MS   5000        // default per expect step
+#define EXPECT_RETRIES      2           // for idempotent input
+
+enum ExpectResult { EXPECT_BUSY, EXPECT_OK, EXPECT_TIMEOUT, EXPECT_FAILED, EXPECT_CANCELLED };
+
+class TTY;
+class TelemetryParser;
+class Histogram;
+
+// host side step, e.g. change the baud rate. Return value: false aborts
+typedef bool (*ExpectAction)(void *context);
+// called once when a sequence is over
+typedef void (*ExpectDone)(void *context, ExpectResult result);
+
+//-----------------------------------------------------------------------------
+  class Expect
+//-----------------------------------------------------------------------------
+{
+  private:
+    enum StepType { STEP_SEND, STEP_EXPECT, STEP_DELAY, STEP_UPLOAD, STEP_ACTION };
+    struct Step {
+        StepType type;
+        char text[256];             // send: bytes, expect: pattern, upload: file
+        unsigned int length;
+        int timeout_ms;             // expect, delay
+        int retries;                // expect
+        bool chunked;               // upload: '%' format first
+        const unsigned char *data;  // upload: file in memory, NULL: file text
+        size_t size;
+        Histogram *hist;            // expect: time until the pattern arrived
+        ExpectAction action;
+        void *context;
+    };
+
+    TTY &bt;
+    const char *tag;                // in front of messages, e.g. "[left] "
+    Step steps[EXPECT_MAXSTEPS];
+    int nSteps;
+    int pos;                        // current step
+    int resendPos;                  // first send step in front of the current expect
+    int retriesLeft;                // current expect, -1: not entered yet
+    unsigned int matchPos;
+    long long stepStart;            // us
+    long long deadline;             // ms
+    ExpectResult result;
+    ExpectDone done;
+    void *doneContext;
+
+    // upload in progress: '%' (uploading) or else '&' (fp)
+    ChunkedUpload chunkedUpload;
+    bool uploading;
+    FILE *fp;
+    const unsigned char *uploadData;    // file in memory, NULL: fp
+    size_t remaining;
+    unsigned short crcValue;
+    bool readError;
+    bool uploadSent;                // upload out, waiting for the menu or an error reply
+    unsigned int replyMatch[3];     // matched length per reply
+
+    Step *add(StepType type);
+    void enter(void);
+    void finish(ExpectResult r);
+    bool uploadBegin(Step *s);
+    void uploadContinue(void);
+    void uploadCheck(void);
+    void uploadReply(char ch);
+
+  public:
+    Expect(TTY& tty, const char *tag = "");
+   ~Expect(void);
+    void clear(void);
+    void send(const char *text);
+    void sendChar(char ch);
+    void expect(const char *pattern, Histogram *hist = NULL,
+                int timeout_ms = EXPECT_TIMEOUT_MS, int retries = 0);
+    void delay(int ms);
+    void upload(const char *fileName, bool chunked = false);
+    void upload(const char *name, const unsigned char *data, size_t size, bool chunked = false);
+    void action(ExpectAction fn, void *context);
+    void start(ExpectDone done = NULL, void *context = NULL);
+    void cancel(void);
+    bool isBusy(void) { return result == EXPECT_BUSY; };
+    ExpectResult getResult(void) { return result; };
+    void feed(const char *text, unsigned int length);
+    bool frame(char header, unsigned long value);
+    void poll(void);
+    int getTimeout(void);
+    ExpectResult run(TelemetryParser& parser);
+};
+
+#endif
@@ -0,0 +1,1114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "gif.h"
+
+// growing output buffer
+struct GifBuffer
+{
+    unsigned char *data;
+    size_t size, capacity;
+};
+
+//-----------------------------------------------------------------------------
+  static void put(GifBuffer *b, const void *data, size_t n)
+//-----------------------------------------------------------------------------
+{
+    if (b->size + n > b->capacity) {
+        b->capacity = (b->size + n) * 2 + 4096;
+        b->data = (unsigned char *) realloc(b->data, b->capacity);
+        if (b->data == NULL) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+    }
+    memcpy(b->data + b->size, data, n);
+    b->size += n;
+}
+
+//-----------------------------------------------------------------------------
+  static void putByte(GifBuffer *b, int c)
+//-----------------------------------------------------------------------------
+{
+    unsigned char ch = c;
+    put(b, &ch, 1);
+}
+
+//-----------------------------------------------------------------------------
+  static void putWord(GifBuffer *b, int w)
+//-----------------------------------------------------------------------------
+{
+    putByte(b, w);
+    putByte(b, w >> 8);
+}
+
+//-----------------------------------------------------------------------------
+  static int paletteBits(int size)
+//-----------------------------------------------------------------------------
+// Return value: k with 2^k >= size, at least 1
+{
+    int k = 1;
+    while ((1 << k) < size) k++;
+    return k;
+}
+
+
+//-----------------------------------------------------------------------------
+  static long lzwDecode(const unsigned char *in, size_t inSize, int minCodeSize,
+                        unsigned char *out, size_t outSize)
+//-----------------------------------------------------------------------------
+// Decode the concatenated data sub-blocks of one image.
+// Return value: number of pixels, -1 on a corrupt code stream
+{
+    static unsigned short prefix[GIF_MAXCODES];
+    static unsigned char suffix[GIF_MAXCODES];
+    static unsigned char stack[GIF_MAXCODES + 1];
+    const int clear = 1 << minCodeSize, eoi = clear + 1;
+    int next = clear + 2, codeSize = minCodeSize + 1;
+    int prev = -1, firstByte = 0, code, c, sp;
+    uint32_t acc = 0;
+    int bits = 0;
+    size_t pos = 0, n = 0;
+
+    for (;;) {
+        while (bits < codeSize) {
+            if (pos >= inSize) return n;        // no EOI: take what we have
+            acc |= (uint32_t)in[pos++] << bits;
+            bits += 8;
+        }
+        code = acc & ((1 << codeSize) - 1);
+        acc >>= codeSize;
+        bits -= codeSize;
+
+        if (code == clear) {
+            next = clear + 2;
+            codeSize = minCodeSize + 1;
+            prev = -1;
+            continue;
+        }
+        if (code == eoi) break;
+        if (prev < 0) {
+            if (code >= clear) return -1;
+            if (n < outSize) out[n] = code;
+            n++;
+            prev = firstByte = code;
+            continue;
+        }
+        if (code > next || (code == next && next >= GIF_MAXCODES)) return -1;
+
+        sp = 0;
+        c = code;
+        if (code == next) {                     // KwKwK: string(prev) + first(prev)
+            stack[sp++] = firstByte;
+            c = prev;
+        }
+        while (c > eoi) {
+            stack[sp++] = suffix[c];
+            c = prefix[c];
+        }
+        stack[sp++] = c;
+        firstByte = c;
+
+        if (next < GIF_MAXCODES) {
+            prefix[next] = prev;
+            suffix[next] = firstByte;
+            next++;
+            if (next == (1 << codeSize) && codeSize < 12) codeSize++;
+        }
+        while (sp > 0) {
+            sp--;
+            if (n < outSize) out[n] = stack[sp];
+            n++;
+        }
+        prev = code;
+    }
+    return n;
+}
+
+
+// LZW encoder state: codes are packed LSB first into 255 byte sub-blocks
+struct LzwWriter
+{
+    GifBuffer *out;
+    uint32_t acc;
+    int bits;
+    unsigned char block[255];
+    int blockLen;
+    unsigned long bitsWritten;
+};
+
+//-----------------------------------------------------------------------------
+  static void lzwEmit(LzwWriter *w, int code, int codeSize)
+//-----------------------------------------------------------------------------
+{
+    w->acc |= (uint32_t)code << w->bits;
+    w->bits += codeSize;
+    w->bitsWritten += codeSize;
+    while (w->bits >= 8) {
+        w->block[w->blockLen++] = w->acc;
+        w->acc >>= 8;
+        w->bits -= 8;
+        if (w->blockLen == 255) {
+            putByte(w->out, 255);
+            put(w->out, w->block, 255);
+            w->blockLen = 0;
+        }
+    }
+}
+
+#define LZW_HASHSIZE    8192        // power of 2, twice GIF_MAXCODES
+#define LZW_WINDOW      4096        // pixels per compression check with a full table
+#define LZW_DEGRADATION 1.10        // clear when a window is this much worse than the best
+
+//-----------------------------------------------------------------------------
+  static void lzwEncode(const unsigned char *pixels, size_t n, int minCodeSize, GifBuffer *out)
+//-----------------------------------------------------------------------------
+// Unlike the usual encoders, a full code table is not cleared right away:
+// it is kept as long as it compresses as well as it did when it filled up,
+// which suits the repetitive content of POV pictures.
+{
+    static int32_t keys[LZW_HASHSIZE];
+    static unsigned short codes[LZW_HASHSIZE];
+    const int clear = 1 << minCodeSize, eoi = clear + 1;
+    int next = 0, codeSize = 0, prefix, codesSinceClear = 0;
+    unsigned long windowStartBits = 0;
+    size_t windowStart = 0;
+    double bestRatio = 0;
+    LzwWriter w;
+    size_t i;
+
+    memset(&w, 0, sizeof w);
+    w.out = out;
+    putByte(out, minCodeSize);
+
+    // the first code of a stream is always a clear code
+    codeSize = minCodeSize + 1;
+    lzwEmit(&w, clear, codeSize);
+    next = clear + 2;
+    memset(keys, 0xFF, sizeof keys);
+
+    prefix = n ? pixels[0] : -1;
+    for (i = 1; i < n; i++) {
+        int32_t key = prefix << 8 | pixels[i];
+        unsigned int h = ((uint32_t)key * 2654435761u) >> (32 - 13);
+        while (keys[h] >= 0 && keys[h] != key) h = (h + 1) & (LZW_HASHSIZE - 1);
+        if (keys[h] == key) {
+            prefix = codes[h];
+            continue;
+        }
+
+        lzwEmit(&w, prefix, codeSize);
+        codesSinceClear++;
+        if (next < GIF_MAXCODES) {
+            keys[h] = key;
+            codes[h] = next++;
+            if (next > (1 << codeSize) && codeSize < 12) codeSize++;
+            if (next == GIF_MAXCODES) {
+                windowStart = i;
+                windowStartBits = w.bitsWritten;
+                bestRatio = 0;
+            }
+        }
+        else if (i - windowStart >= LZW_WINDOW) {
+            // table full: compare the bits per pixel of this window
+            double ratio = (double)(w.bitsWritten - windowStartBits) / (i - windowStart);
+            if (bestRatio == 0 || ratio < bestRatio) bestRatio = ratio;
+            windowStart = i;
+            windowStartBits = w.bitsWritten;
+            if (ratio > bestRatio * LZW_DEGRADATION) {
+                lzwEmit(&w, clear, codeSize);
+                codeSize = minCodeSize + 1;
+                next = clear + 2;
+                codesSinceClear = 0;
+                memset(keys, 0xFF, sizeof keys);
+            }
+        }
+        prefix = pixels[i];
+    }
+    if (prefix >= 0) {
+        lzwEmit(&w, prefix, codeSize);
+        // the decoder adds an entry for this code before it reads EOI
+        if (codesSinceClear > 0 && next < GIF_MAXCODES) {
+            next++;
+            if (next > (1 << codeSize) && codeSize < 12) codeSize++;
+        }
+    }
+    lzwEmit(&w, eoi, codeSize);
+    if (w.bits > 0) lzwEmit(&w, 0, 8 - w.bits);
+    if (w.blockLen > 0) {
+        putByte(out, w.blockLen);
+        put(out, w.block, w.blockLen);
+    }
+    putByte(out, 0);            // block terminator
+}
+
+
+//-----------------------------------------------------------------------------
+  static bool skipSubBlocks(const unsigned char *data, size_t size, size_t *pos)
+//-----------------------------------------------------------------------------
+{
+    while (*pos < size) {
+        unsigned int len = data[(*pos)++];
+        if (len == 0) return true;
+        *pos += len;
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+  static long lzwScan(const unsigned char *data, size_t size, size_t *pos,
+                      int minCodeSize, int *maxIndex, long *codes)
+//-----------------------------------------------------------------------------
+// Walk the code stream of one image in place, sub-block by sub-block, like
+// lzwDecode() but with the length of every string instead of the string.
+// Every pixel goes back to a code below clear that was sent once, so the
+// highest of them is the highest color index.
+// *pos: first sub-block, on return behind the block terminator
+// Return value: number of pixels, -1 on a corrupt or truncated code stream
+{
+    static unsigned short length[GIF_MAXCODES];
+    const int clear = 1 << minCodeSize, eoi = clear + 1;
+    int next = clear + 2, codeSize = minCodeSize + 1;
+    int prev = -1, code;
+    uint32_t acc = 0;
+    int bits = 0;
+    size_t p = *pos, blockEnd = *pos;
+    long n = 0;
+
+    *maxIndex = 0;
+    *codes = 0;
+    for (;;) {
+        while (bits < codeSize) {
+            if (p == blockEnd) {
+                if (p >= size) return -1;
+                blockEnd = p + 1 + data[p];
+                p++;
+                if (blockEnd == p) {            // terminator without EOI
+                    *pos = p;
+                    return n;
+                }
+                if (blockEnd > size) return -1;
+            }
+            acc |= (uint32_t)data[p++] << bits;
+            bits += 8;
+        }
+        code = acc & ((1 << codeSize) - 1);
+        acc >>= codeSize;
+        bits -= codeSize;
+        (*codes)++;
+
+        if (code == clear) {
+            next = clear + 2;
+            codeSize = minCodeSize + 1;
+            prev = -1;
+            continue;
+        }
+        if (code == eoi) break;
+        if (code < clear) {
+            length[code] = 1;
+            if (code > *maxIndex) *maxIndex = code;
+        }
+        if (prev < 0) {
+            if (code >= clear) return -1;
+            n++;
+            prev = code;
+            continue;
+        }
+        if (code > next || (code == next && next >= GIF_MAXCODES)) return -1;
+        if (next < GIF_MAXCODES) {
+            length[next] = length[prev] + 1;    // string(prev) + first(code)
+            next++;
+            if (next == (1 << codeSize) && codeSize < 12) codeSize++;
+        }
+        n += length[code];
+        prev = code;
+    }
+    p = blockEnd;
+    if (!skipSubBlocks(data, size, &p)) return -1;
+    *pos = p;
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+  static int parseImage(const unsigned char *data, size_t size, size_t *pos, GifFile *gif, GifFrame *f)
+//-----------------------------------------------------------------------------
+{
+    size_t p = *pos, start, lzwSize;
+    unsigned char *lzw, *pixels;
+    int flags, maxIndex, i;
+    long n;
+
+    if (p + 9 > size) return GIF_ERROR;
+    f->x = data[p] | data[p+1] << 8;
+    f->y = data[p+2] | data[p+3] << 8;
+    f->width = data[p+4] | data[p+5] << 8;
+    f->height = data[p+6] | data[p+7] << 8;
+    flags = data[p+8];
+    p += 9;
+    f->paletteSize = 0;
+    if (flags & 0x80) {
+        f->paletteSize = 2 << (flags & 7);
+        if (p + f->paletteSize * 3 > size) return GIF_ERROR;
+        memcpy(f->palette, data + p, f->paletteSize * 3);
+        p += f->paletteSize * 3;
+    }
+    if (p >= size || f->width == 0 || f->height == 0) return GIF_ERROR;
+    f->codeSize = data[p++];
+    if (f->codeSize < 2 || f->codeSize > 8) return GIF_ERROR;
+
+    // gather the sub-blocks
+    start = p;
+    if (!skipSubBlocks(data, size, &p)) return GIF_ERROR;
+    lzw = (unsigned char *) malloc(p - start);
+    pixels = (unsigned char *) malloc((size_t)f->width * f->height);
+    if (lzw == NULL || pixels == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    for (lzwSize = 0; data[start]; start += data[start] + 1) {
+        memcpy(lzw + lzwSize, data + start + 1, data[start]);
+        lzwSize += data[start];
+    }
+    n = lzwDecode(lzw, lzwSize, f->codeSize, pixels, (size_t)f->width * f->height);
+    free(lzw);
+    if (n < (long)f->width * f->height) {
+        free(pixels);
+        return GIF_ERROR;
+    }
+
+    // every index must have a color, or remapping would be guesswork
+    maxIndex = f->paletteSize ? f->paletteSize : gif->paletteSize;
+    if (maxIndex == 0) maxIndex = 1 << f->codeSize;
+    for (i = 0; i < f->width * f->height; i++) {
+        if (pixels[i] >= maxIndex) {
+            free(pixels);
+            return GIF_ERROR;
+        }
+    }
+
+    if (flags & 0x40) {
+        // interlaced: rows 0,8,16.. then 4,12.. then 2,6.. then 1,3..
+        static const int startRow[4] = { 0, 4, 2, 1 }, step[4] = { 8, 8, 4, 2 };
+        unsigned char *rows = (unsigned char *) malloc((size_t)f->width * f->height);
+        int pass, y, row = 0;
+        if (rows == NULL) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+        for (pass = 0; pass < 4; pass++)
+            for (y = startRow[pass]; y < f->height; y += step[pass])
+                memcpy(rows + (size_t)y * f->width, pixels + (size_t)row++ * f->width, f->width);
+        free(pixels);
+        pixels = rows;
+    }
+    f->pixels = pixels;
+    *pos = p;
+    return GIF_OK;
+}
+
+//-----------------------------------------------------------------------------
+  int gif_parse(const unsigned char *data, size_t size, GifFile *gif)
+//-----------------------------------------------------------------------------
+{
+    size_t pos;
+    int flags, capacity = 0;
+    GifFrame control;           // graphic control for the next image
+
+    memset(gif, 0, sizeof *gif);
+    memset(&control, 0, sizeof control);
+    control.transparent = -1;
+
+    if (size < 13 || (memcmp(data, "GIF87a", 6) != 0 && memcmp(data, "GIF89a", 6) != 0))
+        return GIF_ERROR;
+    memcpy(gif->version, data, 6);
+    gif->width = data[6] | data[7] << 8;
+    gif->height = data[8] | data[9] << 8;
+    flags = data[10];
+    gif->background = data[11];
+    gif->aspect = data[12];
+    pos = 13;
+    if (flags & 0x80) {
+        gif->paletteSize = 2 << (flags & 7);
+        if (pos + gif->paletteSize * 3 > size) return GIF_ERROR;
+        memcpy(gif->palette, data + pos, gif->paletteSize * 3);
+        pos += gif->paletteSize * 3;
+    }
+
+    while (pos < size) {
+        int block = data[pos++];
+
+        if (block == 0x3B) {                                 // trailer
+            if (gif->nFrames) return GIF_OK;
+            break;
+        }
+
+        if (block == 0x21 && pos < size) {                   // extension
+            size_t start = pos - 1;
+            int label = data[pos++];
+            if (label == 0xF9 && pos + 5 <= size && data[pos] == 4) {
+                control.hasControl = true;
+                control.disposal = (data[pos+1] >> 2) & 7;
+                control.delay = data[pos+2] | data[pos+3] << 8;
+                control.transparent = (data[pos+1] & 1) ? data[pos+4] : -1;
+                pos += 5;
+                if (!skipSubBlocks(data, size, &pos)) break;
+            }
+            else if (label == 0x01) {
+                break;                          // plain text is not supported
+            }
+            else {
+                if (!skipSubBlocks(data, size, &pos)) break;
+                if (label == 0xFF) {            // application: keep (loop count)
+                    gif->extensions = (unsigned char *) realloc(gif->extensions, gif->extensionsSize + pos - start);
+                    memcpy(gif->extensions + gif->extensionsSize, data + start, pos - start);
+                    gif->extensionsSize += pos - start;
+                }
+                // comments are dropped
+            }
+            continue;
+        }
+
+        if (block == 0x2C) {                                 // image
+            if (gif->nFrames == capacity) {
+                capacity = capacity ? capacity * 2 : 16;
+                gif->frames = (GifFrame *) realloc(gif->frames, capacity * sizeof(GifFrame));
+                if (gif->frames == NULL) {
+                    printf("Out of memory\n");
+                    exit(1);
+                }
+            }
+            GifFrame *f = &gif->frames[gif->nFrames];
+            *f = control;
+            f->pixels = NULL;
+            if (parseImage(data, size, &pos, gif, f) != GIF_OK) break;
+            if (f->disposal > 3) f->disposal = 0;   // reserved values
+            gif->nFrames++;
+            memset(&control, 0, sizeof control);
+            control.transparent = -1;
+            continue;
+        }
+        break;
+    }
+    // no trailer: truncated or garbage; nothing of it is kept
+    gif_free(gif);
+    return GIF_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+  long gif_length(const unsigned char *data, size_t size)
+//-----------------------------------------------------------------------------
+// Length of the GIF at the start of data, e.g. the next one of a stream of
+// GIFs sent back to back. Only the block structure is walked, nothing is
+// decoded.
+// Return value: bytes up to and including the trailer, 0: incomplete,
+//               GIF_ERROR: data does not start with a GIF
+{
+    size_t pos = 13;
+    int flags;
+
+    if (memcmp(data, "GIF", size < 3 ? size : 3) != 0) return GIF_ERROR;
+    if (size < 13) return 0;
+    if (memcmp(data, "GIF87a", 6) != 0 && memcmp(data, "GIF89a", 6) != 0) return GIF_ERROR;
+    if (data[10] & 0x80) pos += 3 * (2 << (data[10] & 7));
+
+    while (pos < size) {
+        int block = data[pos++];
+
+        if (block == 0x3B) return pos;                      // trailer
+        if (block == 0x21) pos++;                           // extension label
+        else if (block == 0x2C) {                           // image
+            if (pos + 9 > size) return 0;
+            flags = data[pos+8];
+            pos += 9;
+            if (flags & 0x80) pos += 3 * (2 << (flags & 7));
+            pos++;                                          // LZW code size
+        }
+        else return GIF_ERROR;
+        if (!skipSubBlocks(data, size, &pos)) return 0;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+  int gif_analyze(const unsigned char *data, size_t size, GifInfo *info)
+//-----------------------------------------------------------------------------
+// Same checks as gif_parse(): block structure, complete code streams and
+// color indices within the color table, but nothing is decoded.
+{
+    size_t pos;
+    int flags, paletteSize = 0, delay = -1;
+    GifInfo& gi = *info;
+
+    memset(info, 0, sizeof *info);
+    gi.minDelay = -1;
+    if (size < 13 || (memcmp(data, "GIF87a", 6) != 0 && memcmp(data, "GIF89a", 6) != 0))
+        return GIF_ERROR;
+    gi.width = data[6] | data[7] << 8;
+    gi.height = data[8] | data[9] << 8;
+    flags = data[10];
+    pos = 13;
+    if (flags & 0x80) {
+        paletteSize = 2 << (flags & 7);
+        pos += paletteSize * 3;
+    }
+
+    while (pos < size) {
+        int block = data[pos++];
+
+        if (block == 0x3B) return gi.nFrames ? GIF_OK : GIF_ERROR;    // trailer
+
+        if (block == 0x21 && pos < size) {                   // extension
+            int label = data[pos++];
+            if (label == 0x01) return GIF_ERROR;            // plain text is not supported
+            if (label == 0xF9 && pos + 5 <= size && data[pos] == 4)
+                delay = data[pos+2] | data[pos+3] << 8;
+            if (!skipSubBlocks(data, size, &pos)) return GIF_ERROR;
+            continue;
+        }
+
+        if (block == 0x2C) {                                 // image
+            int x, y, width, height, colors, codeSize, maxIndex;
+            long n, codes;
+
+            if (pos + 9 > size) return GIF_ERROR;
+            x = data[pos] | data[pos+1] << 8;
+            y = data[pos+2] | data[pos+3] << 8;
+            width = data[pos+4] | data[pos+5] << 8;
+            height = data[pos+6] | data[pos+7] << 8;
+            flags = data[pos+8];
+            pos += 9;
+            colors = paletteSize;
+            if (flags & 0x80) {
+                colors = 2 << (flags & 7);
+                pos += colors * 3;
+            }
+            if (pos >= size || width == 0 || height == 0) return GIF_ERROR;
+            codeSize = data[pos++];
+            if (codeSize < 2 || codeSize > 8) return GIF_ERROR;
+            n = lzwScan(data, size, &pos, codeSize, &maxIndex, &codes);
+            if (n < (long)width * height) return GIF_ERROR;
+            if (maxIndex >= (colors ? colors : 1 << codeSize)) return GIF_ERROR;
+
+            if (x + width > gi.width || y + height > gi.height) gi.outside = true;
+            if (flags & 0x40) gi.interlaced = true;
+            if (delay >= 0) {
+                if (gi.minDelay < 0 || delay < gi.minDelay) gi.minDelay = delay;
+                gi.duration += delay;
+            }
+            gi.pixels += (long)width * height;
+            gi.codes += codes;
+            if (codes + (long)width * height > gi.maxFrameWork) gi.maxFrameWork = codes + (long)width * height;
+            gi.nFrames++;
+            delay = -1;
+            continue;
+        }
+        break;
+    }
+    return GIF_ERROR;       // no trailer: truncated or garbage
+}
+
+//-----------------------------------------------------------------------------
+  static unsigned char *readFile(const char *fileName, size_t *size)
+//-----------------------------------------------------------------------------
+{
+    unsigned char *data;
+    FILE *fp;
+    long n;
+
+    fp = fopen(fileName, "rb");
+    if (fp == NULL) return NULL;
+    if (fseek(fp, 0, SEEK_END) != 0 || (n = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+        fclose(fp);
+        return NULL;
+    }
+    data = (unsigned char *) malloc(n ? n : 1);
+    if (data == NULL || fread(data, 1, n, fp) != (size_t)n) {
+        free(data);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+    *size = n;
+    return data;
+}
+
+//-----------------------------------------------------------------------------
+  int gif_read(const char *fileName, GifFile *gif)
+//-----------------------------------------------------------------------------
+{
+    unsigned char *data;
+    size_t size;
+    int result;
+
+    memset(gif, 0, sizeof *gif);
+    data = readFile(fileName, &size);
+    if (data == NULL) return GIF_ERROR;
+    result = gif_parse(data, size, gif);
+    free(data);
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+  int gif_analyze_file(const char *fileName, GifInfo *info, size_t *size)
+//-----------------------------------------------------------------------------
+{
+    unsigned char *data;
+    int result;
+
+    memset(info, 0, sizeof *info);
+    *size = 0;
+    data = readFile(fileName, size);
+    if (data == NULL) return GIF_ERROR;
+    result = gif_analyze(data, *size, info);
+    free(data);
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+  void gif_free(GifFile *gif)
+//-----------------------------------------------------------------------------
+{
+    int i;
+
+    for (i = 0; i < gif->nFrames; i++)
+        free(gif->frames[i].pixels);
+    free(gif->frames);
+    free(gif->extensions);
+    memset(gif, 0, sizeof *gif);
+}
+
+//-----------------------------------------------------------------------------
+  static void encode(const GifFile *gif, GifBuffer *out)
+//-----------------------------------------------------------------------------
+{
+    int i;
+
+    put(out, gif->version, 6);
+    putWord(out, gif->width);
+    putWord(out, gif->height);
+    if (gif->paletteSize) {
+        int k = paletteBits(gif->paletteSize) - 1;
+        putByte(out, 0x80 | k << 4 | k);
+    }
+    else putByte(out, 0);
+    putByte(out, gif->background);
+    putByte(out, gif->aspect);
+    put(out, gif->palette, gif->paletteSize * 3);
+    if (gif->extensionsSize) put(out, gif->extensions, gif->extensionsSize);
+
+    for (i = 0; i < gif->nFrames; i++) {
+        const GifFrame *f = &gif->frames[i];
+        int colors = f->paletteSize ? f->paletteSize : gif->paletteSize;
+        int codeSize = colors ? paletteBits(colors) : f->codeSize;
+
+        if (f->hasControl) {
+            putByte(out, 0x21);
+            putByte(out, 0xF9);
+            putByte(out, 4);
+            putByte(out, f->disposal << 2 | (f->transparent >= 0));
+            putWord(out, f->delay);
+            putByte(out, f->transparent >= 0 ? f->transparent : 0);
+            putByte(out, 0);
+        }
+        putByte(out, 0x2C);
+        putWord(out, f->x);
+        putWord(out, f->y);
+        putWord(out, f->width);
+        putWord(out, f->height);
+        if (f->paletteSize) {
+            putByte(out, 0x80 | (paletteBits(f->paletteSize) - 1));
+            put(out, f->palette, f->paletteSize * 3);
+        }
+        else putByte(out, 0);
+        lzwEncode(f->pixels, (size_t)f->width * f->height, codeSize < 2 ? 2 : codeSize, out);
+    }
+    putByte(out, 0x3B);
+}
+
+//-----------------------------------------------------------------------------
+  int gif_write(const char *fileName, const GifFile *gif)
+//-----------------------------------------------------------------------------
+{
+    GifBuffer out;
+    FILE *fp;
+    int result = GIF_OK;
+
+    memset(&out, 0, sizeof out);
+    encode(gif, &out);
+    fp = fopen(fileName, "wb");
+    if (fp == NULL || fwrite(out.data, 1, out.size, fp) != out.size) result = GIF_ERROR;
+    if (fp && fclose(fp) != 0) result = GIF_ERROR;
+    free(out.data);
+    return result;
+}
+
+
+// Rendering for the optimizer: a canvas pixel is 0 while transparent,
+// 0x01RRGGBB once a frame has painted it.
+
+//-----------------------------------------------------------------------------
+  static void paint(const GifFile *gif, const GifFrame *f, uint32_t *canvas)
+//-----------------------------------------------------------------------------
+{
+    const unsigned char *palette = f->paletteSize ? f->palette : gif->palette;
+    int x, y;
+
+    for (y = 0; y < f->height && f->y + y < gif->height; y++) {
+        const unsigned char *row = f->pixels + (size_t)y * f->width;
+        uint32_t *dst = canvas + (size_t)(f->y + y) * gif->width + f->x;
+        for (x = 0; x < f->width && f->x + x < gif->width; x++) {
+            int i = row[x];
+            if (i == f->transparent) continue;
+            dst[x] = 0x01000000 | palette[3*i] << 16 | palette[3*i+1] << 8 | palette[3*i+2];
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+  static void dispose(const GifFile *gif, const GifFrame *f, uint32_t *canvas, const uint32_t *saved)
+//-----------------------------------------------------------------------------
+{
+    int y, w;
+
+    if (f->disposal == 2) {
+        w = f->x + f->width > gif->width ? gif->width - f->x : f->width;
+        for (y = f->y; y < f->y + f->height && y < gif->height && w > 0; y++)
+            memset(canvas + (size_t)y * gif->width + f->x, 0, w * sizeof(uint32_t));
+    }
+    else if (f->disposal == 3) {
+        memcpy(canvas, saved, (size_t)gif->width * gif->height * sizeof(uint32_t));
+    }
+}
+
+//-----------------------------------------------------------------------------
+  static bool sameAnimation(const GifFile *a, const GifFile *b, const bool *keep)
+//-----------------------------------------------------------------------------
+// b must show exactly what a shows, with a's frames !keep[i] merged into the
+// kept frame before them
+{
+    size_t screen = (size_t)a->width * a->height;
+    uint32_t *ca = (uint32_t *) calloc(screen * 4, sizeof(uint32_t));
+    uint32_t *sa = ca + screen, *cb = ca + 2*screen, *sb = ca + 3*screen;
+    bool same = a->width == b->width && a->height == b->height;
+    int i, j = -1, delay = 0;
+
+    if (ca == NULL) return false;
+    for (i = 0; i < a->nFrames && same; i++) {
+        const GifFrame *fa = &a->frames[i];
+        if (fa->disposal == 3) memcpy(sa, ca, screen * sizeof(uint32_t));
+        paint(a, fa, ca);
+        if (keep[i]) {
+            if (j >= 0 && b->frames[j].delay != delay) same = false;
+            if (++j >= b->nFrames) {
+                same = false;
+                break;
+            }
+            const GifFrame *fb = &b->frames[j];
+            if (fb->disposal == 3) memcpy(sb, cb, screen * sizeof(uint32_t));
+            paint(b, fb, cb);
+            delay = 0;
+        }
+        delay += fa->delay;
+        if (memcmp(ca, cb, screen * sizeof(uint32_t)) != 0) same = false;
+        if (keep[i]) dispose(b, &b->frames[j], cb, sb);
+        dispose(a, fa, ca, sa);
+    }
+    if (j < 0 || j != b->nFrames - 1 || b->frames[j].delay != delay) same = false;
+    free(ca);
+    return same;
+}
+
+//-----------------------------------------------------------------------------
+  static void trimPalette(unsigned char *palette, int *paletteSize, GifFrame **frames, int nFrames, int *background)
+//-----------------------------------------------------------------------------
+// Remove the entries no pixel uses and merge entries of the same color.
+// An index that is transparent in any of the frames keeps a slot of its own.
+{
+    bool used[GIF_MAXCOLORS], transparent[GIF_MAXCOLORS];
+    unsigned char newPalette[GIF_MAXCOLORS*3];
+    unsigned char map[GIF_MAXCOLORS];
+    int i, j, k, count = 0;
+
+    memset(used, 0, sizeof used);
+    memset(transparent, 0, sizeof transparent);
+    for (k = 0; k < nFrames; k++) {
+        GifFrame *f = frames[k];
+        bool hasTransparent = false;
+        for (i = 0; i < f->width * f->height; i++) {
+            if (f->pixels[i] == f->transparent) hasTransparent = true;
+            else used[f->pixels[i]] = true;
+        }
+        // a transparent index without transparent pixels has no effect
+        if (hasTransparent) transparent[f->transparent] = true;
+        else f->transparent = -1;
+    }
+    if (background && *background < *paletteSize) used[*background] = true;
+
+    for (i = 0; i < *paletteSize; i++) {
+        if (!used[i] && !transparent[i]) continue;
+        if (!transparent[i]) {
+            for (j = 0; j < i; j++) {
+                if ((used[j] || transparent[j]) && !transparent[j] &&
+                    memcmp(&palette[3*j], &palette[3*i], 3) == 0) break;
+            }
+            if (j < i) {
+                map[i] = map[j];
+                continue;
+            }
+        }
+        map[i] = count;
+        memcpy(&newPalette[3*count], &palette[3*i], 3);
+        count++;
+    }
+
+    *paletteSize = 1 << paletteBits(count);
+    memset(palette, 0, *paletteSize * 3);
+    memcpy(palette, newPalette, count * 3);
+    for (k = 0; k < nFrames; k++) {
+        GifFrame *f = frames[k];
+        for (i = 0; i < f->width * f->height; i++)
+            f->pixels[i] = map[f->pixels[i]];
+        if (f->transparent >= 0) f->transparent = map[f->transparent];
+    }
+    if (background) *background = *background < count ? map[*background] : 0;
+}
+
+//-----------------------------------------------------------------------------
+  int gif_optimize(const char *inName, const char *outName, GifReport *report)
+//-----------------------------------------------------------------------------
+{
+    GifFile in, out, check;
+    GifBuffer buf;
+    unsigned char *data;
+    size_t size, screen;
+    uint32_t *canvas, *before, *saved;
+    bool *keep;
+    GifFrame **globalFrames;
+    int i, last = -1, nGlobal = 0, result;
+
+    memset(report, 0, sizeof *report);
+    data = readFile(inName, &size);
+    if (data == NULL) return GIF_ERROR;
+    report->inSize = report->outSize = size;
+    result = gif_parse(data, size, &in);
+    free(data);
+    if (result != GIF_OK) return GIF_ERROR;
+
+    report->framesIn = report->framesOut = in.nFrames;
+    report->colorsIn = in.paletteSize;
+    for (i = 0; i < in.nFrames; i++) report->colorsIn += in.frames[i].paletteSize;
+
+    out = in;
+    out.frames = (GifFrame *) calloc(in.nFrames, sizeof(GifFrame));
+    out.nFrames = 0;
+    out.extensions = NULL;
+    if (in.extensionsSize) {
+        out.extensions = (unsigned char *) malloc(in.extensionsSize);
+        memcpy(out.extensions, in.extensions, in.extensionsSize);
+    }
+    screen = (size_t)in.width * in.height;
+    canvas = (uint32_t *) calloc(screen * 3, sizeof(uint32_t));
+    keep = (bool *) calloc(in.nFrames, sizeof(bool));
+    globalFrames = (GifFrame **) calloc(in.nFrames, sizeof(GifFrame *));
+    if (out.frames == NULL || canvas == NULL || keep == NULL || globalFrames == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    before = canvas + screen;
+    saved = canvas + 2*screen;
+
+    for (i = 0; i < in.nFrames; i++) {
+        GifFrame *f = &in.frames[i];
+        int x0 = in.width, y0 = in.height, x1 = -1, y1 = -1, x, y;
+        bool clipped = f->x + f->width > in.width || f->y + f->height > in.height;
+
+        memcpy(before, canvas, screen * sizeof(uint32_t));
+        if (f->disposal == 3) memcpy(saved, canvas, screen * sizeof(uint32_t));
+        paint(&in, f, canvas);
+
+        // rectangle of the pixels this frame changes
+        for (y = f->y; y < f->y + f->height && y < in.height; y++) {
+            for (x = f->x; x < f->x + f->width && x < in.width; x++) {
+                if (canvas[(size_t)y * in.width + x] == before[(size_t)y * in.width + x]) continue;
+                if (x < x0) x0 = x;
+                if (x > x1) x1 = x;
+                if (y < y0) y0 = y;
+                y1 = y;
+            }
+        }
+        bool keeps = f->disposal < 2;       // leaves the canvas as painted
+        bool unchanged = x1 < 0;
+
+        if (unchanged && keeps && last >= 0 && in.frames[last].disposal < 2 && i > 0) {
+            // nothing new to see: show the previous frame longer
+            out.frames[out.nFrames - 1].delay += f->delay;
+            if (f->delay) out.frames[out.nFrames - 1].hasControl = true;
+        }
+        else {
+            GifFrame *o = &out.frames[out.nFrames++];
+            *o = *f;
+            if (!(i > 0 && keeps && !unchanged) || clipped) {
+                x0 = f->x;
+                y0 = f->y;
+                x1 = f->x + f->width - 1;
+                y1 = f->y + f->height - 1;
+            }
+            o->x = x0;
+            o->y = y0;
+            o->width = x1 - x0 + 1;
+            o->height = y1 - y0 + 1;
+            o->pixels = (unsigned char *) malloc((size_t)o->width * o->height);
+            if (o->pixels == NULL) {
+                printf("Out of memory\n");
+                exit(1);
+            }
+            for (y = 0; y < o->height; y++)
+                memcpy(o->pixels + (size_t)y * o->width,
+                       f->pixels + (size_t)(y + y0 - f->y) * f->width + (x0 - f->x), o->width);
+            keep[i] = true;
+            last = i;
+        }
+        dispose(&in, f, canvas, saved);
+    }
+    free(canvas);
+
+    for (i = 0; i < out.nFrames; i++) {
+        GifFrame *f = &out.frames[i];
+        if (f->paletteSize) trimPalette(f->palette, &f->paletteSize, &f, 1, NULL);
+        else globalFrames[nGlobal++] = f;
+    }
+    if (out.paletteSize) trimPalette(out.palette, &out.paletteSize, globalFrames, nGlobal, &out.background);
+    free(globalFrames);
+
+    memset(&buf, 0, sizeof buf);
+    encode(&out, &buf);
+
+    // decode the result again: only an exact match is used
+    result = gif_parse(buf.data, buf.size, &check);
+    if (result == GIF_OK && !sameAnimation(&in, &check, keep)) result = GIF_ERROR;
+    gif_free(&check);
+    if (result == GIF_OK) {
+        report->outSize = buf.size;
+        report->framesOut = out.nFrames;
+        report->colorsOut = out.paletteSize;
+        for (i = 0; i < out.nFrames; i++) report->colorsOut += out.frames[i].paletteSize;
+        if (buf.size >= size) result = GIF_NOGAIN;
+    }
+    else printf("GIF optimizer: verification of %s failed\n", inName);
+
+    if (result == GIF_OK) {
+        FILE *fp = fopen(outName, "wb");
+        if (fp == NULL || fwrite(buf.data, 1, buf.size, fp) != buf.size) result = GIF_ERROR;
+        if (fp && fclose(fp) != 0) result = GIF_ERROR;
+    }
+    free(buf.data);
+    free(keep);
+    gif_free(&out);
+    gif_free(&in);
+    return result;
+}
+
+#ifdef GIF_SELFTEST
+// LZW round trip test and optimizer command line, see gif.sh.
+#include <time.h>
+
+//-----------------------------------------------------------------------------
+  int main(int argc, char *argv[])
+//-----------------------------------------------------------------------------
+{
+    static unsigned char pixels[200000], decoded[200000];
+    int errors = 0, codeSize, kind, i;
+
+    for (codeSize = 2; codeSize <= 8; codeSize++) {
+        for (kind = 0; kind < 3; kind++) {
+            GifBuffer buf;
+            unsigned char *lzw;
+            size_t pos, n = 0;
+            long got;
+
+            // random (table fills and clears), runs (KwKwK), mixed
+            for (i = 0; i < (int)sizeof pixels; i++) {
+                if (kind == 0) pixels[i] = rand() % (1 << codeSize);
+                else if (kind == 1) pixels[i] = (i / 1000) % (1 << codeSize);
+                else pixels[i] = (i / 7 + (rand() % 8 == 0)) % (1 << codeSize);
+            }
+            memset(&buf, 0, sizeof buf);
+            lzwEncode(pixels, sizeof pixels, codeSize, &buf);
+            lzw = (unsigned char *) malloc(buf.size);
+            for (pos = 1; buf.data[pos]; pos += buf.data[pos] + 1) {
+                memcpy(lzw + n, buf.data + pos + 1, buf.data[pos]);
+                n += buf.data[pos];
+            }
+            got = lzwDecode(lzw, n, codeSize, decoded, sizeof decoded);
+            if (got != (long)sizeof pixels || memcmp(pixels, decoded, sizeof pixels) != 0) {
+                printf("LZW round trip failed: code size %d, pattern %d\n", codeSize, kind);
+                errors++;
+            }
+
+            // the scan must count the same pixels and find the highest index
+            int maxIndex, expected = 0;
+            long codes;
+            pos = 1;                            // behind the code size
+            for (i = 0; i < (int)sizeof pixels; i++) if (pixels[i] > expected) expected = pixels[i];
+            got = lzwScan(buf.data, buf.size, &pos, codeSize, &maxIndex, &codes);
+            if (got != (long)sizeof pixels || maxIndex != expected || pos != buf.size) {
+                printf("LZW scan failed: code size %d, pattern %d: %ld pixels, index %d\n", codeSize, kind, got, maxIndex);
+                errors++;
+            }
+            free(lzw);
+            free(buf.data);
+        }
+    }
+    printf("LZW round trip %s\n", errors ? "FAILED" : "OK");
+
+    for (i = 1; i + 1 < argc; i += 2) {
+        GifReport r;
+        int result = gif_optimize(argv[i], argv[i+1], &r);
+        printf("%s: %s, %lu -> %lu bytes, %d -> %d frames, %d -> %d colors\n", argv[i],
+               result == GIF_OK ? "optimized" : result == GIF_NOGAIN ? "no gain" : "error",
+               (unsigned long)r.inSize, (unsigned long)r.outSize,
+               r.framesIn, r.framesOut, r.colorsIn, r.colorsOut);
+        if (result == GIF_ERROR) errors++;
+
+        // the scan accepts what the decoder accepts and is much faster
+        GifInfo info;
+        GifFile gif;
+        size_t size;
+        long long t0 = clock(), t1, t2;
+        int analyzed = gif_analyze_file(argv[i], &info, &size);
+        t1 = clock();
+        int parsed = gif_read(argv[i], &gif);
+        t2 = clock();
+        if (analyzed != parsed) {
+            printf("%s: gif_analyze %d, gif_read %d\n", argv[i], analyzed, parsed);
+            errors++;
+        }
+        if (parsed == GIF_OK) {
+            long pixels = 0;
+            for (int k = 0; k < gif.nFrames; k++) pixels += (long)gif.frames[k].width * gif.frames[k].height;
+            if (info.nFrames != gif.nFrames || info.pixels != pixels) {
+                printf("%s: gif_analyze %d frames %ld pixels, gif_read %d frames %ld pixels\n",
+                       argv[i], info.nFrames, info.pixels, gif.nFrames, pixels);
+                errors++;
+            }
+            printf("%s: analyzed in %.3f ms, parsed in %.3f ms\n", argv[i],
+                   (t1 - t0) * 1000. / CLOCKS_PER_SEC, (t2 - t1) * 1000. / CLOCKS_PER_SEC);
+            gif_free(&gif);
+        }
+
+        // the block walk of the stream reader must find the same end
+        unsigned char *data = readFile(argv[i], &size);
+        if (data && result != GIF_ERROR) {
+            long length = gif_length(data, size);
+            if (length != (long)size || gif_length(data, size - 1) != 0) {
+                printf("%s: gif_length %ld of %lu bytes\n", argv[i], length, (unsigned long)size);
+                errors++;
+            }
+        }
+        free(data);
+    }
+    return errors != 0;
+}
+#endif
@@ -0,0 +1,86 @@
+#ifndef GIF_H
+#define GIF_H
+
+#include <stddef.h>
+
+// GIF reader, writer and lossless optimizer.
+//
+// gif_optimize() shrinks a GIF before it is uploaded to the cylinder without
+// changing a single displayed pixel:
+//   - frames identical to the previous one are dropped, their delay is
+//     added to the previous frame,
+//   - frames are cropped to the rectangle that really changes,
+//   - palette entries no frame uses are removed, duplicates merged,
+//   - LZW is re-encoded with the smallest code size the palette allows and
+//     a code table that is only cleared when compression degrades.
+// The result is decoded again and compared frame by frame against the
+// original; anything that does not match exactly is not used.
+//
+// gif_analyze() checks a GIF completely and fast, e.g. before an upload:
+// every code stream is walked with string lengths instead of strings, so
+// no pixel is written and no memory is allocated.
+
+#define GIF_OK            0
+#define GIF_ERROR       (-1)        // not a GIF or unsupported feature
+#define GIF_NOGAIN      (-2)        // optimized file would not be smaller
+
+#define GIF_MAXCODES   4096
+#define GIF_MAXCOLORS   256
+
+struct GifFrame
+{
+    int x, y, width, height;
+    int delay;                      // 1/100 s
+    int disposal;                   // 0/1: keep, 2: background, 3: previous
+    int transparent;                // transparent color index, -1: none
+    bool hasControl;                // graphic control extension present
+    int paletteSize;                // local color table entries, 0: global
+    unsigned char palette[GIF_MAXCOLORS*3];
+    int codeSize;                   // LZW minimum code size as read
+    unsigned char *pixels;          // width*height indices, rows top down
+};
+
+struct GifFile
+{
+    char version[7];                // "GIF87a" or "GIF89a"
+    int width, height;              // logical screen
+    int paletteSize;                // global color table entries, 0: none
+    unsigned char palette[GIF_MAXCOLORS*3];
+    int background;
+    int aspect;
+    unsigned char *extensions;      // application extensions (loop count), raw
+    size_t extensionsSize;
+    GifFrame *frames;
+    int nFrames;
+};
+
+struct GifReport
+{
+    size_t inSize, outSize;
+    int framesIn, framesOut;
+    int colorsIn, colorsOut;        // palette entries of all color tables
+};
+
+// Result of gif_analyze(): what the whole animation costs, without pixels.
+struct GifInfo
+{
+    int width, height;              // logical screen
+    int nFrames;
+    int minDelay;                   // 1/100 s, shortest frame delay, -1: no delays
+    long duration;                  // 1/100 s, all frame delays
+    bool outside;                   // a frame reaches beyond the logical screen
+    bool interlaced;                // a frame is interlaced
+    long pixels, codes;             // LZW output and input of all frames
+    long maxFrameWork;              // codes + pixels of the heaviest frame
+};
+
+int  gif_analyze(const unsigned char *data, size_t size, GifInfo *info);
+int  gif_analyze_file(const char *fileName, GifInfo *info, size_t *size);
+int  gif_parse(const unsigned char *data, size_t size, GifFile *gif);
+long gif_length(const unsigned char *data, size_t size);
+int  gif_read(const char *fileName, GifFile *gif);
+int  gif_write(const char *fileName, const GifFile *gif);
+void gif_free(GifFile *gif);
+int  gif_optimize(const char *inName, const char *outName, GifReport *report);
+
+#endif
@@ -0,0 +1 @@
+g++ -O2 -Wall -DGIF_SELFTEST -o gif.exe gif.cpp
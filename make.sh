@@ -1,2 +1,3 @@
-g++ -g -Wall  -o /home/Harald/bin/pccp pccp.cpp motor.cpp command.cpp
-
+g++ -g -Wall  -o /home/Harald/bin/pccp pccp.cpp tty.cpp motor.cpp command.cpp crc.cpp upload.cpp telemetry.cpp recorder.cpp stats.cpp gif.cpp playlist.cpp expect.cpp device.cpp server.cpp stream.cpp tune.cpp preflight.cpp
+g++ -g -Wall  -o /home/Harald/bin/povsim povsim.cpp crc.cpp -lpthread -lm
+g++ -g -Wall  -o /home/Harald/bin/povrec povrec.cpp recorder.cpp
@@ -10,11 +10,13 @@
 #include <arpa/inet.h>
 #include <sys/wait.h>
 #include <signal.h>
-#include <time.h>       // clock function
-#include <sys/times.h>
+#include <math.h>
+#include <fcntl.h>
+#include <poll.h>
 
 
 #include "motor.h"
+#include "stats.h"
 
 #define DEFAULT_PORT "3490"
 #define MAX_DUTY_CYCLE_VALUE 4096
@@ -24,139 +26,527 @@
 
 #define SERVERNAME "192.168.10.106"
 
+// PID speed controller, all in % duty cycle and Hz
+#define FF_DUTY_PER_HZ     3.33     // feedforward: duty = FF_DUTY_PER_HZ * f + FF_DUTY_OFFSET
+#define FF_DUTY_OFFSET     6.7      //   (60 % for 16 Hz)
+#define PID_KP             8.0      // % per Hz
+#define PID_KI             3.0      // % per Hz*s
+#define PID_KD             0.5      // % per Hz/s
+#define PID_MAX_RATE      30.0      // max duty change in % per s
+#define PID_MAX_INTEGRAL  30.0      // integral part limited to +/- this
+#define MAX_DUTY_CYCLE    99.0
+
+// a controller is settled when the speed stays within SETTLE_BAND for
+// SETTLE_TIME; jitter is the rms error after settling
+#define SETTLE_BAND        0.05     // Hz
+#define SETTLE_TIME        3.0      // s
+
+// connection to the motor server
+#define MOTOR_CONNECT_TIMEOUT_MS    3000    // per address
+#define MOTOR_REPLY_TIMEOUT_MS      1000    // answer to a duty cycle value
+#define MOTOR_BACKOFF_MIN_MS        500
+#define MOTOR_BACKOFF_MAX_MS        30000
+
+// duty cycle table: weight of a new settled sample, minimum time between saves
+#define TABLE_WEIGHT       0.02     // ~50 samples
+#define TABLE_SAVE_MS      60000
+
+static Histogram dutyCycleRtt("motor setDutyCycle", "us");
+
 //-----------------------------------------------------------------------------
   Motor::Motor(void)
 //-----------------------------------------------------------------------------
 {
+    int i;
+
     ConnectSocket = INVALID_SOCKET;
+    server[0] = 0;
+    tag = "";
+    linkState = LINK_OFF;
+    addresses = address = NULL;
+    retryAt = 0;
+    backoff = MOTOR_BACKOFF_MIN_MS;
+    dutyCycleSet = false;
+    replyPending = sendPending = false;
+    replyDeadline = sentAt = 0;
+    for (i = 0; i < MOTOR_TABLE_SIZE; i++) dutyTable[i] = 0.;
+    tableName[0] = 0;
+    tableChanged = false;
+    tableSaved = 0;
+    dutyCycle = 0.;
+    controlMode = CONTROL_STEP;
+    step = newDutyCycle = 0.;
+    tLastStep = 0;
+    lastSample = 0.;
     setWantedFreq(16.00);    // us = 16 Hz
 }
 
 //-----------------------------------------------------------------------------
-  void Motor::init(void)
+  void Motor::setWantedFreq(double freq)
+//-----------------------------------------------------------------------------
+{
+    wantedFreq = freq;
+    wantedPeriod = 1e6 / freq + 0.5;
+    settleStart = now_us() / 1e6;
+    inBandSince = 0.;
+    settlingTime = -1.;
+    errorSquare = 0.;
+}
+
+//-----------------------------------------------------------------------------
+  void Motor::setControlMode(ControlMode mode)
+//-----------------------------------------------------------------------------
+{
+    controlMode = mode;
+    lastSample = 0.;        // restart the PID from the current duty cycle
+    setWantedFreq(wantedFreq);
+}
+
+//-----------------------------------------------------------------------------
+  void Motor::warmStart(double freq)
+//-----------------------------------------------------------------------------
+// new wanted frequency, starting right at the duty cycle learned for it
+{
+    setWantedFreq(freq);
+    setDutyCycle(getFeedForward(freq));
+    lastSample = 0.;        // the PID starts bumpless from there
+}
+
+//-----------------------------------------------------------------------------
+  double Motor::getFeedForward(double freq)
+//-----------------------------------------------------------------------------
+// duty cycle that keeps the cylinder at freq without any correction:
+// interpolated between the nearest learned entries, beyond them and
+// without any the slope of the linear model
+{
+    double duty = FF_DUTY_PER_HZ * freq + FF_DUTY_OFFSET;
+    int i, lo = -1, hi = -1;
+
+    for (i = 0; i < MOTOR_TABLE_SIZE; i++) {
+        if (dutyTable[i] == 0.) continue;
+        if (i * MOTOR_TABLE_STEP <= freq) lo = i;
+        if (i * MOTOR_TABLE_STEP >= freq && hi < 0) hi = i;
+    }
+    if (lo >= 0 && hi >= 0 && lo != hi)
+        duty = dutyTable[lo] + (dutyTable[hi] - dutyTable[lo]) *
+               (freq - lo * MOTOR_TABLE_STEP) / ((hi - lo) * MOTOR_TABLE_STEP);
+    else if (lo >= 0) duty = dutyTable[lo] + FF_DUTY_PER_HZ * (freq - lo * MOTOR_TABLE_STEP);
+    else if (hi >= 0) duty = dutyTable[hi] + FF_DUTY_PER_HZ * (freq - hi * MOTOR_TABLE_STEP);
+    if (duty < 0.) duty = 0.;
+    if (duty > MAX_DUTY_CYCLE) duty = MAX_DUTY_CYCLE;
+    return duty;
+}
+
+//-----------------------------------------------------------------------------
+  void Motor::learn(double freq)
+//-----------------------------------------------------------------------------
+// settled sample: the current duty cycle holds freq
+{
+    int i = (int)(freq / MOTOR_TABLE_STEP + 0.5);
+    double duty;
+    long long t;
+
+    if (i <= 0 || i >= MOTOR_TABLE_SIZE) return;
+    // moved to the frequency of the entry along the linear model
+    duty = dutyCycle + FF_DUTY_PER_HZ * (i * MOTOR_TABLE_STEP - freq);
+    if (duty <= 0.) return;
+    if (dutyTable[i] == 0.) dutyTable[i] = duty;
+    else dutyTable[i] += (duty - dutyTable[i]) * TABLE_WEIGHT;
+    tableChanged = true;
+    t = now_ms();
+    if (t - tableSaved >= TABLE_SAVE_MS) saveTable();
+}
+
+//-----------------------------------------------------------------------------
+  bool Motor::loadTable(const char *fileName)
+//-----------------------------------------------------------------------------
+// Table of an earlier run, lines "<Hz> <duty %>". A missing file is an
+// empty table; the table is saved to fileName from now on.
+// Return value: false if the file could not be read
+{
+    char line[80];
+    double freq, duty;
+    FILE *fp;
+    int i, n = 0;
+
+    strncpy(tableName, fileName, sizeof tableName - 1);
+    tableName[sizeof tableName - 1] = 0;
+    fp = fopen(tableName, "r");
+    if (fp == NULL) return errno == ENOENT;
+    while (fgets(line, sizeof line, fp)) {
+        if (sscanf(line, "%lf %lf", &freq, &duty) != 2) continue;
+        i = (int)(freq / MOTOR_TABLE_STEP + 0.5);
+        if (i <= 0 || i >= MOTOR_TABLE_SIZE || duty <= 0. || duty > MAX_DUTY_CYCLE) continue;
+        dutyTable[i] = duty;
+        n++;
+    }
+    fclose(fp);
+    printf("%sMotor duty cycle table %s: %d entries\n", tag, tableName, n);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+  void Motor::saveTable(void)
+//-----------------------------------------------------------------------------
+// written to a temporary file first, a crash never leaves half a table
+{
+    char tempName[sizeof tableName + 4];
+    FILE *fp;
+    bool ok;
+    int i;
+
+    tableSaved = now_ms();
+    if (!tableChanged || tableName[0] == 0) return;
+    snprintf(tempName, sizeof tempName, "%s.tmp", tableName);
+    fp = fopen(tempName, "w");
+    if (fp == NULL) {
+        printf("%sCannot write motor duty cycle table %s: %s\n", tag, tempName, strerror(errno));
+        tableName[0] = 0;   // don't try again every minute
+        return;
+    }
+    fprintf(fp, "# pccp motor duty cycle table: <Hz> <duty cycle %%>\n");
+    for (i = 0; i < MOTOR_TABLE_SIZE; i++)
+        if (dutyTable[i] > 0.) fprintf(fp, "%.1f %.2f\n", i * MOTOR_TABLE_STEP, dutyTable[i]);
+    ok = fclose(fp) == 0;
+    if (ok && rename(tempName, tableName) == 0) tableChanged = false;
+    else printf("%sCannot write motor duty cycle table %s\n", tag, tableName);
+}
+
+//-----------------------------------------------------------------------------
+  double Motor::getJitter(void)
+//-----------------------------------------------------------------------------
+// rms speed error in Hz since the controller settled, <0 while not settled
+{
+    return settlingTime < 0. ? -1. : sqrt(errorSquare);
+}
+
+//-----------------------------------------------------------------------------
+  void Motor::init(const char *serverName, const char *tagText)
+//-----------------------------------------------------------------------------
+// server: "host", "host:port" or "[IPv6 address]:port", NULL for
+// SERVERNAME:DEFAULT_PORT
+// The name is resolved here, connecting only starts, see poll().
+{
+    strncpy(server, serverName ? serverName : SERVERNAME, sizeof server - 1);
+    server[sizeof server - 1] = 0;
+    tag = tagText;
+    linkState = LINK_WAIT;
+    retryAt = 0;
+    backoff = MOTOR_BACKOFF_MIN_MS;
+    poll();
+}
+
+//-----------------------------------------------------------------------------
+  bool Motor::resolve(void)
 //-----------------------------------------------------------------------------
+// Addresses of the server. An IP address (the usual case) is converted
+// without a name server; a host name is looked up until it resolves once,
+// as getaddrinfo() blocks the main loop while it waits for the name server.
+// Return value: false if there is no address yet, the next try is scheduled
 {
-    struct addrinfo *result = NULL,
-                    *ptr = NULL,
-                    hints;
+    struct addrinfo hints;
+    char host[sizeof server];
+    const char *name = host;
+    const char *port = DEFAULT_PORT;
+    char *colon;
     int iResult;
-    
-    //ZeroMemory( &hints, sizeof(hints) );
+
+    strcpy(host, server);
+    if (host[0] == '[' && (colon = strchr(host, ']')) != NULL) {
+        *colon = 0;
+        name = host + 1;
+        if (colon[1] == ':') port = colon + 2;
+    }
+    else if ((colon = strchr(host, ':')) != NULL && strchr(colon + 1, ':') == NULL) {
+        // one colon: host:port, more: an IPv6 address without port
+        *colon = 0;
+        port = colon + 1;
+    }
     memset(&hints, 0, sizeof hints);
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_protocol = IPPROTO_TCP;
 
-    // Resolve the server address and port
-    iResult = getaddrinfo(SERVERNAME, DEFAULT_PORT, &hints, &result);
-    if ( iResult != 0 ) {
-        printf("getaddrinfo failed with error: %d\n", errno);
-        exit(1);
+    if (addresses) freeaddrinfo(addresses);
+    addresses = NULL;
+    iResult = getaddrinfo(name, port, &hints, &addresses);
+    if (iResult != 0) {
+        addresses = NULL;
+        // e.g. no network yet at boot: like a failed connect
+        retryAt = now_ms() + backoff;
+        printf("\n%sMotor server %s: %s - retrying in %.1f s\n", tag, server, gai_strerror(iResult), backoff / 1000.);
+        backoff = backoff * 2 > MOTOR_BACKOFF_MAX_MS ? MOTOR_BACKOFF_MAX_MS : backoff * 2;
+        return false;
     }
+    return true;
+}
 
-    // Attempt to connect to an address until one succeeds
-    for(ptr=result; ptr != NULL ;ptr=ptr->ai_next) {
+//-----------------------------------------------------------------------------
+  void Motor::poll(void)
+//-----------------------------------------------------------------------------
+// call once per main loop pass: connect and reply timeouts, the next attempt
+{
+    if (linkState == LINK_UP && replyPending && now_ms() >= replyDeadline) {
+        linkDown("no answer");
+        return;
+    }
+    if (linkState == LINK_CONNECTING && now_ms() >= retryAt) {
+        close(ConnectSocket);
+        ConnectSocket = INVALID_SOCKET;
+        connectFrom(address->ai_next);
+        return;
+    }
+    if (linkState != LINK_WAIT || now_ms() < retryAt) return;
+    if (addresses == NULL && !resolve()) return;
+    connectFrom(addresses);
+}
 
-        // Create a SOCKET for connecting to server
-        ConnectSocket = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
-        if (ConnectSocket == INVALID_SOCKET) {
-            printf("socket failed with error: %d\n", errno);
-            exit(1);
+//-----------------------------------------------------------------------------
+  void Motor::connectFrom(struct addrinfo *ai)
+//-----------------------------------------------------------------------------
+// start a non-blocking connect to the first address that takes one;
+// after the last one wait for the next round
+{
+    for (; ai != NULL; ai = ai->ai_next) {
+        ConnectSocket = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (ConnectSocket == INVALID_SOCKET) continue;
+        fcntl(ConnectSocket, F_SETFL, fcntl(ConnectSocket, F_GETFL) | O_NONBLOCK);
+        address = ai;
+        if (connect(ConnectSocket, ai->ai_addr, ai->ai_addrlen) == 0) {
+            connected();
+            return;
         }
-
-        // Connect to server.
-        iResult = connect( ConnectSocket, ptr->ai_addr, (int)ptr->ai_addrlen);
-        if (iResult == -1) {
-            close(ConnectSocket);
-            ConnectSocket = INVALID_SOCKET;
-            continue;
+        if (errno == EINPROGRESS) {
+            linkState = LINK_CONNECTING;
+            retryAt = now_ms() + MOTOR_CONNECT_TIMEOUT_MS;
+            return;
         }
-        break;
+        close(ConnectSocket);
+        ConnectSocket = INVALID_SOCKET;
     }
+    linkState = LINK_WAIT;
+    retryAt = now_ms() + backoff;
+    printf("\n%sUnable to connect to motor server %s - retrying in %.1f s\n", tag, server, backoff / 1000.);
+    backoff = backoff * 2 > MOTOR_BACKOFF_MAX_MS ? MOTOR_BACKOFF_MAX_MS : backoff * 2;
+}
 
-    freeaddrinfo(result);
+//-----------------------------------------------------------------------------
+  void Motor::connected(void)
+//-----------------------------------------------------------------------------
+{
+    linkState = LINK_UP;
+    backoff = MOTOR_BACKOFF_MIN_MS;
+    printf("\n%sConnected to motor server %s\n", tag, server);
+    if (dutyCycleSet) sendDutyCycle();
+}
 
-    if (ConnectSocket == INVALID_SOCKET) {
-        printf("Unable to connect to server!\n");
-        exit(1);
+//-----------------------------------------------------------------------------
+  void Motor::linkDown(const char *reason)
+//-----------------------------------------------------------------------------
+{
+    printf("\n%sMotor server %s: %s - reconnecting in %.1f s\n", tag, server, reason, backoff / 1000.);
+    close(ConnectSocket);
+    ConnectSocket = INVALID_SOCKET;
+    linkState = LINK_WAIT;
+    retryAt = now_ms() + backoff;
+    replyPending = sendPending = false;
+}
+
+//-----------------------------------------------------------------------------
+  int Motor::getTimeout(void)
+//-----------------------------------------------------------------------------
+// Return value: poll() timeout in ms until poll() has to be called, -1: none
+{
+    long long t;
+
+    if (linkState == LINK_UP && replyPending) t = replyDeadline - now_ms();
+    else if (linkState == LINK_WAIT || linkState == LINK_CONNECTING) t = retryAt - now_ms();
+    else return -1;
+    return t < 0 ? 0 : (int)t;
+}
+
+//-----------------------------------------------------------------------------
+  short Motor::getPollEvents(void)
+//-----------------------------------------------------------------------------
+// a connect completes with the socket becoming writable
+{
+    return linkState == LINK_CONNECTING ? POLLOUT : POLLIN;
+}
+
+//-----------------------------------------------------------------------------
+  const char *Motor::getLinkStateName(void)
+//-----------------------------------------------------------------------------
+{
+    switch (linkState) {
+        case LINK_UP:         return "connected";
+        case LINK_CONNECTING: return "connecting";
+        case LINK_WAIT:       return "waiting to reconnect";
+        default:              return "not used";
     }
 }
 
 //-----------------------------------------------------------------------------
   void Motor::setDutyCycle(double newDutyCycle)
 //-----------------------------------------------------------------------------
+// Sent right away unless the server has not answered the previous value
+// yet; then it follows the answer. Without a connection it is sent when
+// the connection is (back) up.
 {
-  const int DEFAULT_BUFLEN = 16;
-  char sendbuf[DEFAULT_BUFLEN];
-  char recvbuf[DEFAULT_BUFLEN];
+  dutyCycle = newDutyCycle;
+  dutyCycleSet = true;
+  if (linkState != LINK_UP) return;
+  if (replyPending) sendPending = true;
+  else sendDutyCycle();
+}
+
+//-----------------------------------------------------------------------------
+  void Motor::sendDutyCycle(void)
+//-----------------------------------------------------------------------------
+// The answer is taken by handleInput(), poll() gives up on it after
+// MOTOR_REPLY_TIMEOUT_MS. Errors lead to a reconnect.
+{
+  char sendbuf[16];
+  char reason[80];
   int iResult;
-  int recvbuflen = DEFAULT_BUFLEN;
   unsigned int dutyCycleValue;
 
-  dutyCycle = newDutyCycle;
   dutyCycleValue = (unsigned int)(dutyCycle/100.*MAX_DUTY_CYCLE_VALUE);
   if (dutyCycleValue >= MAX_DUTY_CYCLE_VALUE) dutyCycleValue = MAX_DUTY_CYCLE_VALUE - 1;
   
   sprintf(sendbuf, "%u", dutyCycleValue);
-  iResult = send(ConnectSocket, sendbuf, (int)strlen(sendbuf), 0 );
-  if (iResult == SOCKET_ERROR) {
-      printf("send failed with error: %d\n", errno);
-      close(ConnectSocket);
-      exit(1);
+  sentAt = now_us();
+  // a few bytes with nothing else in flight always fit into the socket buffer
+  iResult = send(ConnectSocket, sendbuf, (int)strlen(sendbuf), MSG_NOSIGNAL);
+  if (iResult != (int)strlen(sendbuf)) {
+      if (iResult == SOCKET_ERROR) snprintf(reason, sizeof reason, "send failed: %s", strerror(errno));
+      else snprintf(reason, sizeof reason, "send incomplete");
+      linkDown(reason);
+      return;
   }
+  replyPending = true;
+  sendPending = false;
+  replyDeadline = now_ms() + MOTOR_REPLY_TIMEOUT_MS;
+}
 
-  // read response
-      iResult = recv(ConnectSocket, recvbuf, recvbuflen, 0);
-      if ( iResult == 1 ) {
-          int errorCode = recvbuf[0] - '0';
-          switch (errorCode) {
-              case 0:
-                  break;
-              case 1:
-                  printf("Error code 1: No valid integer\n");
-                  exit(1);
-              case 2:
-                  printf("Error code 2: PWM value out of range\n");
-                  exit(1);
-              default:
-                  printf("Error code %d: Unknown error code\n", errorCode);
-                  exit(1);
-          }
-      }
-      else if (iResult > 1) {
-          printf("Received message has more than one byte (%d bytes)!\n", iResult);
-          exit(1);
-      }
-      else if ( iResult == 0 ) {
-          printf("Connection closed\n");
-          exit(1);
-      }
-      else {
-          printf("recv failed with error: %d\n", errno);
-          exit(1);
-      }
+//-----------------------------------------------------------------------------
+  void Motor::reply(char code)
+//-----------------------------------------------------------------------------
+// one byte answer to a duty cycle value
+{
+  int errorCode = code - '0';
+
+  dutyCycleRtt.record(now_us() - sentAt);
+  replyPending = false;
+  switch (errorCode) {
+      case 0:
+          break;
+      case 1:
+          printf("%sMotor server error code 1: No valid integer\n", tag);
+          break;
+      case 2:
+          printf("%sMotor server error code 2: PWM value out of range\n", tag);
+          break;
+      default:
+          printf("%sMotor server error code %d: Unknown error code\n", tag, errorCode);
+          break;
+  }
+  if (sendPending) sendDutyCycle();
 }
 
 
 //-----------------------------------------------------------------------------
   void Motor::control(unsigned int period)
 //-----------------------------------------------------------------------------
+// called for every {p} sample
 {
-    static double step, newDutyCycle;
-    static clock_t tLast=0;
-    clock_t t;
+    double t = now_us() / 1e6;
+
+    if (period == 0) return;
+    updateStatistics(1e6 / period, t);
+    if (controlMode == CONTROL_PID) controlPid(period, t);
+    else controlStep(period);
+}
+
+//-----------------------------------------------------------------------------
+  void Motor::updateStatistics(double freq, double t)
+//-----------------------------------------------------------------------------
+{
+    double error = wantedFreq - freq;
+
+    if (settlingTime < 0.) {
+        if (fabs(error) > SETTLE_BAND) inBandSince = 0.;
+        else if (inBandSince == 0.) inBandSince = t;
+        else if (t - inBandSince >= SETTLE_TIME) settlingTime = inBandSince - settleStart;
+    }
+    else {
+        errorSquare += (error * error - errorSquare) * 0.02;   // ~50 samples
+        learn(freq);
+    }
+}
+
+//-----------------------------------------------------------------------------
+  void Motor::controlPid(unsigned int period, double t)
+//-----------------------------------------------------------------------------
+// PID on the rotation frequency plus feedforward from the wanted frequency.
+// The output change is rate limited. Anti-windup: the integral is frozen
+// while saturation or the rate limit hold the output back.
+{
+    double freq = 1e6 / period;
+    double error = wantedFreq - freq;
+    double dt, ff, raw, out, maxStep, newIntegral;
+
+    if (lastSample == 0.) {
+        // first sample: start bumpless from the current duty cycle
+        lastSample = t;
+        lastFreq = freq;
+        pidDutyCycle = dutyCycle;
+        integral = dutyCycle - getFeedForward(wantedFreq) - PID_KP * error;
+        if (integral >  PID_MAX_INTEGRAL) integral =  PID_MAX_INTEGRAL;
+        if (integral < -PID_MAX_INTEGRAL) integral = -PID_MAX_INTEGRAL;
+        return;
+    }
+    dt = t - lastSample;
+    if (dt <= 0.) return;
+    if (dt > 1.) dt = 1.;       // samples got lost: don't jump
+    lastSample = t;
+
+    ff = getFeedForward(wantedFreq);
+    newIntegral = integral + PID_KI * error * dt;
+    if (newIntegral >  PID_MAX_INTEGRAL) newIntegral =  PID_MAX_INTEGRAL;
+    if (newIntegral < -PID_MAX_INTEGRAL) newIntegral = -PID_MAX_INTEGRAL;
+    raw = ff + PID_KP * error + newIntegral - PID_KD * (freq - lastFreq) / dt;
+    lastFreq = freq;
+
+    out = raw;
+    maxStep = PID_MAX_RATE * dt;
+    if (out > pidDutyCycle + maxStep) out = pidDutyCycle + maxStep;
+    if (out < pidDutyCycle - maxStep) out = pidDutyCycle - maxStep;
+    if (out > MAX_DUTY_CYCLE) out = MAX_DUTY_CYCLE;
+    if (out < 0.) out = 0.;
+
+    // anti-windup: don't integrate while the limits hold the output back
+    if (!((raw > out && error > 0.) || (raw < out && error < 0.))) integral = newIntegral;
+    pidDutyCycle = out;
+
+    // only talk to the motor server if the PWM value really changes
+    if ((unsigned int)(out/100.*MAX_DUTY_CYCLE_VALUE) != (unsigned int)(dutyCycle/100.*MAX_DUTY_CYCLE_VALUE))
+        setDutyCycle(out);
+}
+
+//-----------------------------------------------------------------------------
+  void Motor::controlStep(unsigned int period)
+//-----------------------------------------------------------------------------
+{
+    long long t;
     int delta = period - wantedPeriod;   
-    double deltaTimeSec;
-    struct tms buf;
-
-    // ensure a constant sampling frequency of 2 Hz
-    // the clock() function does not work in CYGWIN!
-    t = times(&buf);
-    deltaTimeSec = (float)(t - tLast)/ CLK_TCK;
-    //printf("\n DeltaTime = %5.2f\n", deltaTimeSec);
+
+    // ensure a constant sampling frequency of 2 Hz, per motor
+    // (clock() counts CPU time and does not work in CYGWIN)
+    t = now_ms();
+    //printf("\n DeltaTime = %5.2f\n", (t - tLastStep) / 1000.);
     
-    if(deltaTimeSec < 0.5) return;
-    tLast = t;
+    if (t - tLastStep < 500) return;
+    tLastStep = t;
     
     step = abs(delta) < 6000 ? 0.2 : 1.00;
     //step = (double) abs(delta) / 12000.;
@@ -169,6 +559,50 @@
 
 
 
+//-----------------------------------------------------------------------------
+  void Motor::handleInput(void)
+//-----------------------------------------------------------------------------
+// Called from the main loop when the socket is ready: a connect has
+// completed, or the server sent something. It only answers duty cycle
+// values, anything else is stray bytes or the connection going away.
+{
+  char recvbuf[16];
+  char reason[80];
+  int iResult;
+
+  if (linkState == LINK_CONNECTING) {
+      int error = 0;
+      socklen_t len = sizeof error;
+      if (getsockopt(ConnectSocket, SOL_SOCKET, SO_ERROR, &error, &len) != 0) error = errno;
+      if (error == EINPROGRESS) return;
+      if (error == 0) {
+          connected();
+          return;
+      }
+      close(ConnectSocket);
+      ConnectSocket = INVALID_SOCKET;
+      connectFrom(address->ai_next);
+      return;
+  }
+  if (linkState != LINK_UP) return;
+  iResult = recv(ConnectSocket, recvbuf, sizeof recvbuf, MSG_DONTWAIT);
+  if ( iResult == 0 ) {
+      linkDown("connection closed");
+  }
+  else if ( iResult < 0 ) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+      snprintf(reason, sizeof reason, "recv failed: %s", strerror(errno));
+      linkDown(reason);
+  }
+  else if (!replyPending) printf("%sIgnoring %d unexpected bytes from motor server\n", tag, iResult);
+  else if (iResult == 1) reply(recvbuf[0]);
+  else {
+      // out of step with the server: start over on a new connection
+      snprintf(reason, sizeof reason, "answer has more than one byte (%d bytes)", iResult);
+      linkDown(reason);
+  }
+}
+
 
 // Destructor
 //-----------------------------------------------------------------------------
@@ -176,6 +610,7 @@
 //-----------------------------------------------------------------------------
 {
     if (ConnectSocket != INVALID_SOCKET) close(ConnectSocket);
+    if (addresses) freeaddrinfo(addresses);
 }
 
 
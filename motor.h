@@ -1,18 +1,104 @@
+// Motor server connection: init() resolves the server and only starts
+// connecting. Connecting and the duty cycle exchange run non-blocking in the
+// main loop (getSocket(), getPollEvents(), getTimeout(), poll(),
+// handleInput()); a failed name lookup, a failed attempt, a broken
+// connection or a missing answer is retried with a backoff from
+// MOTOR_BACKOFF_MIN_MS doubling up to MOTOR_BACKOFF_MAX_MS. The duty cycle set while there is no connection is
+// sent once it is up; one set while the server has not answered the
+// previous value yet follows the answer.
+//
+// Duty cycle table: while the automatic control is settled, the duty cycle
+// that holds the speed is learned per MOTOR_TABLE_STEP and saved to a file,
+// so the next run and every change of the wanted frequency (warmStart())
+// begin with a duty cycle close to the final one. getFeedForward()
+// interpolates it; without learned entries it is the fixed linear model.
+
+struct addrinfo;
+
+#define MOTOR_TABLE_STEP    0.5     // Hz per table entry
+#define MOTOR_TABLE_SIZE    81      // 0..40 Hz
+
 class Motor 
 {
+  public:
+    enum ControlMode { CONTROL_STEP, CONTROL_PID };
+
   private:
+    enum LinkState { LINK_OFF, LINK_WAIT, LINK_CONNECTING, LINK_UP };
+
     int ConnectSocket;
+    char server[256];           // "host", "host:port" or "[IPv6 address]:port"
+    const char *tag;            // in front of messages, e.g. "[left] "
+    LinkState linkState;
+    struct addrinfo *addresses;
+    struct addrinfo *address;   // the one being connected
+    long long retryAt;          // ms, next attempt (LINK_WAIT) or connect timeout
+    int backoff;                // ms
+    bool dutyCycleSet;          // dutyCycle is to be sent on connecting
+    bool replyPending;          // a value was sent, its answer is outstanding
+    bool sendPending;           // dutyCycle changed while replyPending
+    long long replyDeadline;    // ms
+    long long sentAt;           // us, for the round trip time
+
+    double dutyTable[MOTOR_TABLE_SIZE];     // %, 0: not learned
+    char tableName[256];        // "": not saved
+    bool tableChanged;
+    long long tableSaved;       // ms
+
     double dutyCycle;
     double wantedFreq;
     unsigned int wantedPeriod;
+    ControlMode controlMode;
+
+    // step speed controller state
+    double step;                // duty cycle change per sample in %
+    double newDutyCycle;
+    long long tLastStep;        // ms, last sample taken, 2 Hz
+
+    // PID speed controller state
+    double integral;            // integral part in % duty cycle
+    double lastFreq;            // previous measurement for the D part
+    double lastSample;          // time of previous sample in s, 0: none
+    double pidDutyCycle;        // unrounded controller output
+
+    // settling time and jitter of the active controller
+    double settleStart;         // time of the last change of wantedFreq
+    double inBandSince;         // first sample of the current in-band run
+    double settlingTime;        // s, <0 while not settled
+    double errorSquare;         // running mean of the squared error
+
+    void controlStep(unsigned int rotationPeriod_us);
+    void controlPid(unsigned int rotationPeriod_us, double t);
+    void updateStatistics(double freq, double t);
+    void learn(double freq);
+    bool resolve(void);
+    void sendDutyCycle(void);
+    void reply(char code);
+    void connectFrom(struct addrinfo *ai);
+    void connected(void);
+    void linkDown(const char *reason);
 
   public:
      Motor(void);
     ~Motor(void);
      void setDutyCycle(double dutyCycle);
-     void setWantedFreq(double freq) { wantedFreq = freq; wantedPeriod = 1e6 / freq + 0.5; };
+     void setWantedFreq(double freq);
      double getWantedFreq(void) { return wantedFreq; };
      double getDutyCycle(void) { return dutyCycle; };
+     void setControlMode(ControlMode mode);
+     ControlMode getControlMode(void) { return controlMode; };
+     void warmStart(double freq);
+     double getFeedForward(double freq);
+     double getSettlingTime(void) { return settlingTime; };
+     double getJitter(void);
      void control(unsigned int rotationPeriod_us);
-     void init(void);
-};     
\ No newline at end of file
+     void init(const char *server = NULL, const char *tag = "");
+     void poll(void);
+     int getTimeout(void);
+     void handleInput(void);
+     int getSocket(void) { return ConnectSocket; };
+     short getPollEvents(void);
+     const char *getLinkStateName(void);
+     bool loadTable(const char *fileName);
+     void saveTable(void);
+};     
@@ -5,12 +5,138 @@
 #include <fcntl.h>      // File control definitions
 #include <errno.h>      // Error number definitions
 #include <termios.h>    // POSIX terminal control definitions
+#include <poll.h>       // poll() based main loop
+#include <sys/stat.h>   // fstat()
+#include <signal.h>     // SIGUSR1 dumps the statistics
 
+#include "tty.h"        // serial link to the POV cylinder
 #include "motor.h"      // motor control over TCP/IP
 #include "command.h"    // read command file from graphical front-end
+#include "crc.h"        // CRC-16-CCITT of uploaded files
+#include "telemetry.h"  // parser for console text and in-band frames
+#include "recorder.h"   // binary telemetry recording
+#include "stats.h"      // clock and latency histograms
+#include "gif.h"        // lossless GIF optimizer
+#include "playlist.h"   // GIF shows with display durations
+#include "expect.h"     // non-blocking command sequences
+#include "device.h"     // what the cylinder holds
+#include "server.h"     // Unix domain socket API
+#include "stream.h"     // live frames from a pipe or file sequence
+#include "tune.h"       // fastest motor speed without skipped columns
+#include "preflight.h"  // GIF check against the limits of the cylinder
 
 // PC Control Program for POV Cylinder
 
+static bool optChunkedUpload = false;
+static bool optOptimizeGif = false;
+static bool optMenuUpload = false;      // stream frames without 'f', needs firmware support
+
+// latency and throughput instrumentation, see stats.h
+static Histogram histGuiDetect("GUI command detect", "us");
+static Histogram histGuiCommand("GUI command total", "us");
+static Histogram histPrompt("device prompt", "us");
+static Histogram histMenu("device menu", "us");
+static Histogram histKeyEcho("key echo", "us");
+static Histogram histUpload("GIF upload", "bytes/s");
+static Histogram histPlaylistGap("playlist gap", "us");
+static Histogram histApi("API command", "us");
+static Histogram histStreamFrame("stream frame", "us");
+static volatile sig_atomic_t dumpStats = 0;
+static volatile sig_atomic_t quit = 0;
+static int signalPipe[2] = { -1, -1 }; // the signal handlers wake up poll() through it
+
+#define KEY_CANCEL 24                   // Ctrl-X stops a running sequence
+#define KEY_NEXT   9                    // Tab: keys go to the next cylinder
+#define PCCP_MAXCYLINDERS 16
+
+void telemetryEvent(void *context, const TelemetryEvent& ev);
+
+//-----------------------------------------------------------------------------
+  struct Cylinder
+//-----------------------------------------------------------------------------
+// Everything pccp keeps per POV cylinder. One cylinder is set up from the
+// command line; with -M every line of the configuration file is one (see
+// load_config()). All of them are served by the same poll() loop.
+{
+    char name[32];
+    char tag[40];                   // "[name] " in front of its output, "" with one cylinder
+    char ttyDevice[256];
+    int baud;
+    int maxBaud;                    // 0: no baud rate probing
+    bool hwFlowControl;
+    char motorServer[256];          // "": motor control disabled
+    char dutyTable[256];            // learned duty cycles, "": default in $HOME
+    bool automaticMotorControl;
+    bool autoTune;                  // wanted frequency from the tuner (needs automaticMotorControl)
+    char playlistName[256];         // "": none
+    char streamSource[256];         // "": no live frames
+
+    TTY *bt;
+    Expect *seq;                    // command sequence to the cylinder
+    TelemetryParser telemetry;
+    Motor motor;
+    Recorder recorder;
+    DeviceState device;
+    Playlist playlist;
+    FrameStream stream;
+    SpeedTuner tuner;
+    unsigned long long showKey;     // show of the running sequence, see tune.h
+
+    char uploadName[256];           // file the sequence uploads
+    const unsigned char *uploadData;    // the file in memory, NULL: uploadName
+    bool uploadTemp;                // uploadName is an optimized copy
+    size_t uploadSize;
+    bool uploadIdentified;          // uploadCrc/uploadSourceSize are valid
+    unsigned short uploadCrc;       // of the file before -z, see device.h
+    size_t uploadSourceSize;
+    long long uploadStart;          // us
+    long long guiCommandTime;       // us, time the GUI wrote the command file
+    long long keyTime;              // us, last key sent to the cylinder
+    bool lineStart;                 // next console text starts a new line
+    bool apiRequest;                // the running sequence answers an API request
+
+    unsigned int period;            // last in-band telemetry values
+    unsigned int numSkippedColumns;
+    unsigned int rotationCounter;
+
+    Cylinder(void);
+};
+
+static Cylinder *cylinders[PCCP_MAXCYLINDERS];
+static int nCylinders = 0;
+static ApiServer server;
+
+//-----------------------------------------------------------------------------
+  Cylinder::Cylinder(void) : telemetry(telemetryEvent, this), tuner(motor, tag)
+//-----------------------------------------------------------------------------
+{
+    strcpy(name, "cylinder");
+    tag[0] = 0;
+    strcpy(ttyDevice, "/dev/ttyS6");
+    baud = TTY_DEFAULT_BAUD;
+    maxBaud = 0;
+    hwFlowControl = false;
+    motorServer[0] = 0;
+    dutyTable[0] = 0;
+    automaticMotorControl = false;
+    autoTune = false;
+    playlistName[0] = 0;
+    streamSource[0] = 0;
+    bt = NULL;
+    seq = NULL;
+    uploadName[0] = 0;
+    uploadData = NULL;
+    uploadTemp = false;
+    uploadSize = 0;
+    uploadIdentified = false;
+    guiCommandTime = 0;
+    keyTime = 0;
+    lineStart = true;
+    apiRequest = false;
+    showKey = 0;
+    period = numSkippedColumns = rotationCounter = 0;
+}
+
 //-----------------------------------------------------------------------------
   class KBD
 //-----------------------------------------------------------------------------
@@ -22,6 +148,7 @@
     ~KBD(void);
      int kbhit(void);
      int getch(void);
+     int getHandle(void) { return STDIN_FILENO; };
 };     
      
 //-----------------------------------------------------------------------------
@@ -77,317 +204,315 @@
   int KBD::getch (void)
 //-----------------------------------------------------------------------------
 {
-  int c;
+  unsigned char c;
 
   /* Must be in raw or cbreak mode for this to work correctly. */
-  //if (read (STDIN_FILENO, &c, 1) != 1)
-  //  c = EOF;
-  c = getchar();
+  /* Read directly from the descriptor: stdio buffering would hide */
+  /* pending keys from poll() in the main loop.                    */
+  if (read (STDIN_FILENO, &c, 1) != 1)
+    return EOF;
 
-  return c & 0xff;
+  return c;
 }
 
 
 
 //-----------------------------------------------------------------------------
-  class TTY {
+  static void wakeMainLoop(void)
 //-----------------------------------------------------------------------------
+// a signal that arrives just before poll() must not wait for the next event
+{
+    int saved = errno;
 
-private: 
-    int handle;
-    int lastCharRead;
-    struct termios tty, tty_old;    
-    void init(void);
+    if (write(signalPipe[1], "", 1) < 0) {}     // full: poll() wakes up anyway
+    errno = saved;
+}
 
-public:
-    TTY(const char *device);     
-   ~TTY(void);
-    int isCharAvailable(void);
-    int getChar(void);
-    void putChar(char ch);
-    void putData(unsigned char *data, size_t size);
-};
 
-                
 //-----------------------------------------------------------------------------
-  TTY::TTY(const char *device)
+  static void onSigUsr1(int)
 //-----------------------------------------------------------------------------
 {
-    /* Open File Descriptor */  // "/dev/ttyS7"
+    dumpStats = 1;
+    wakeMainLoop();
+}
 
-    handle = open(device , O_RDWR| O_NOCTTY);
 
-    /* Error Handling */
-    if (handle < 0 )
-    {
-        printf("Error %d\n", errno);
-        exit(1);
-    }
-    
-    /* *** Configure Port *** */
-    memset (&tty, 0, sizeof tty);
-    
-    /* Error Handling */
-    if (tcgetattr(handle, &tty) != 0)
-    {
-        printf("Error %d from tcgetattr: %s\n", errno, strerror(errno));
-        exit(1);
-    }
-    tty_old = tty;
-    
-    /* Set Baud Rate */
-    cfsetospeed (&tty, B9600);
-    cfsetispeed (&tty, B9600);
-    
-    /* Setting other Port Stuff */
-    tty.c_cflag     &=  ~PARENB;        // Make 8n1
-    tty.c_cflag     &=  ~CSTOPB;
-    tty.c_cflag     &=  ~CSIZE;
-    tty.c_cflag     |=  CS8;
-
-    tty.c_cflag     &=  ~CRTSCTS;       // no flow control
-    //  MIN == 0, TIME == 0 (polling read)
-    //    If data is available, read() returns immediately, with the
-    //    lesser of the number of bytes available, or the number of
-    //    bytes requested.  If no data is available, read(2) returns 0.    
-    tty.c_cc[VMIN]  =  0;               
-    tty.c_cc[VTIME] =  1;               
-    
-    tty.c_cflag     |= CREAD | CLOCAL;  // turn on READ & ignore ctrl lines
-    
-    /* Make raw */
-    cfmakeraw(&tty);
-    
-    /* Flush Port, then applies attributes */
-    tcflush(handle, TCIFLUSH);
-    
-    if (tcsetattr(handle, TCSANOW, &tty) != 0)
-    {
-        printf("Error %d  from tcsetattr\n", errno);
-        exit(1);
+//-----------------------------------------------------------------------------
+  static void onSigTerm(int)
+//-----------------------------------------------------------------------------
+// a daemon has no '.' key: end like it, with statistics and socket removed
+{
+    quit = 1;
+    wakeMainLoop();
+}
+
+
+//-----------------------------------------------------------------------------
+  static void prepare_gif_file(Cylinder& c, const char *fileName)
+//-----------------------------------------------------------------------------
+// With -z the file goes through the lossless GIF optimizer (gif.h) first.
+// c.uploadName is the file to send.
+{
+    char optimizedName[] = "/tmp/pccp-XXXXXX";
+    GifReport r;
+    int fd, result;
+
+    strncpy(c.uploadName, fileName, sizeof c.uploadName - 1);
+    if (optOptimizeGif && (fd = mkstemp(optimizedName)) >= 0) {
+        close(fd);
+        result = gif_optimize(fileName, optimizedName, &r);
+        if (result == GIF_OK) {
+            printf("GIF optimizer: %s %lu -> %lu bytes (-%.1f%%), %d -> %d frames, %d -> %d colors\n",
+                   fileName, (unsigned long)r.inSize, (unsigned long)r.outSize,
+                   100. * (r.inSize - r.outSize) / r.inSize,
+                   r.framesIn, r.framesOut, r.colorsIn, r.colorsOut);
+            strcpy(c.uploadName, optimizedName);
+            c.uploadTemp = true;
+            return;
+        }
+        if (result == GIF_NOGAIN) printf("GIF optimizer: %s cannot be made smaller\n", fileName);
+        else printf("GIF optimizer: %s is not a GIF the optimizer supports - sending it unchanged\n", fileName);
+        unlink(optimizedName);
     }
-    lastCharRead = -1;
 }
 
 
 //-----------------------------------------------------------------------------
-  TTY::~TTY(void)
+  static void release_gif_file(Cylinder& c)
 //-----------------------------------------------------------------------------
 {
-    /* restore the former settings */
-    close(handle);
+    if (c.uploadTemp) unlink(c.uploadName);
+    c.uploadTemp = false;
 }
 
 
 //-----------------------------------------------------------------------------
-  int TTY::isCharAvailable(void)
+  static void identify_upload(Cylinder& c, const char *fileName)
 //-----------------------------------------------------------------------------
 {
-    unsigned char ch;
-    int n;
-    
-    if (lastCharRead>=0) return 1;
-    
-    n = read(handle, &ch , 1);
-    
-    /* Error Handling */
-    if (n < 0)
-    {
-         printf("Error reading: %s\n", strerror(errno));
-         exit(1);
-    }
-    if (n==0) return 0;
-    
-    lastCharRead = ch;
-    return 1;  
+    c.uploadIdentified = crc_file(fileName, &c.uploadCrc, &c.uploadSourceSize);
 }
 
 
 //-----------------------------------------------------------------------------
-  int TTY::getChar(void)
+  static bool uploadBegin(void *context)
 //-----------------------------------------------------------------------------
 {
-    int c;
-    while (!isCharAvailable())
-      ;
-      
-    c = lastCharRead;
-    lastCharRead = -1;
-    return c;
+    Cylinder *c = (Cylinder *)context;
+    struct stat st;
+
+    if (c->uploadData == NULL) c->uploadSize = stat(c->uploadName, &st) == 0 ? st.st_size : 0;
+    c->uploadStart = now_us();
+    return true;
 }
 
 
 //-----------------------------------------------------------------------------
-  void TTY::putChar(char ch)
+  static bool uploadEnd(void *context)
 //-----------------------------------------------------------------------------
+// the device accepted the file and the menu is back
 {
-    int n = write(handle, &ch, 1);
-    if (n!=1) printf("BT write error\n");
+    Cylinder *c = (Cylinder *)context;
+
+    if (c->uploadSize) histUpload.record(c->uploadSize * 1e6 / (now_us() - c->uploadStart));
+    if (c->uploadIdentified) c->device.fileStored(c->uploadCrc, c->uploadSourceSize);
+    return true;
 }
 
 
 //-----------------------------------------------------------------------------
-  void TTY::putData(unsigned char *data, size_t size)
+  static void queue_upload(Cylinder& c, const unsigned char *data = NULL, size_t size = 0)
 //-----------------------------------------------------------------------------
+// add the upload of c.uploadName to the sequence being set up
+// data, size: the file in memory, c.uploadName only names it
 {
-#if 0
-    size_t i;
-    for (i=0; i<size; i++) {
-        printf("%02X", data[i]);
-        if ((i&63)==63) printf("\n");
-    }
-    printf("\n");
-#endif
-#if 1
-    size_t n = write(handle, data, size);
-    if (n!=size) printf("BT write error\n");
-#endif
-    }
-
-
-// CRC according to CCITT. See: http://automationwiki.com/index.php?title=CRC-16-CCITT
-//-----------------------------------------------------------------------------
-  unsigned short crc(unsigned char *data, size_t length)
-//-----------------------------------------------------------------------------
-{ 
-    static unsigned short crc_table [256] = {    
-    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5,
-    0x60c6, 0x70e7, 0x8108, 0x9129, 0xa14a, 0xb16b,
-    0xc18c, 0xd1ad, 0xe1ce, 0xf1ef, 0x1231, 0x0210,
-    0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
-    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c,
-    0xf3ff, 0xe3de, 0x2462, 0x3443, 0x0420, 0x1401,
-    0x64e6, 0x74c7, 0x44a4, 0x5485, 0xa56a, 0xb54b,
-    0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
-    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6,
-    0x5695, 0x46b4, 0xb75b, 0xa77a, 0x9719, 0x8738,
-    0xf7df, 0xe7fe, 0xd79d, 0xc7bc, 0x48c4, 0x58e5,
-    0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
-    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969,
-    0xa90a, 0xb92b, 0x5af5, 0x4ad4, 0x7ab7, 0x6a96,
-    0x1a71, 0x0a50, 0x3a33, 0x2a12, 0xdbfd, 0xcbdc,
-    0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
-    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03,
-    0x0c60, 0x1c41, 0xedae, 0xfd8f, 0xcdec, 0xddcd,
-    0xad2a, 0xbd0b, 0x8d68, 0x9d49, 0x7e97, 0x6eb6,
-    0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
-    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a,
-    0x9f59, 0x8f78, 0x9188, 0x81a9, 0xb1ca, 0xa1eb,
-    0xd10c, 0xc12d, 0xf14e, 0xe16f, 0x1080, 0x00a1,
-    0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
-    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c,
-    0xe37f, 0xf35e, 0x02b1, 0x1290, 0x22f3, 0x32d2,
-    0x4235, 0x5214, 0x6277, 0x7256, 0xb5ea, 0xa5cb,
-    0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
-    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447,
-    0x5424, 0x4405, 0xa7db, 0xb7fa, 0x8799, 0x97b8,
-    0xe75f, 0xf77e, 0xc71d, 0xd73c, 0x26d3, 0x36f2,
-    0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
-    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9,
-    0xb98a, 0xa9ab, 0x5844, 0x4865, 0x7806, 0x6827,
-    0x18c0, 0x08e1, 0x3882, 0x28a3, 0xcb7d, 0xdb5c,
-    0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
-    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0,
-    0x2ab3, 0x3a92, 0xfd2e, 0xed0f, 0xdd6c, 0xcd4d,
-    0xbdaa, 0xad8b, 0x9de8, 0x8dc9, 0x7c26, 0x6c07,
-    0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
-    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba,
-    0x8fd9, 0x9ff8, 0x6e17, 0x7e36, 0x4e55, 0x5e74,
-    0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
-    };
-
-   size_t count;
-   unsigned int crc = 0; // seed=0
-   unsigned int temp;
-   
-
-   for (count = 0; count < length; ++count)
-   {
-     temp = (*data++ ^ (crc >> 8)) & 0xff;
-     crc = crc_table[temp] ^ (crc << 8);
-   }
-
-   return (unsigned short)(crc ^ 0);  // final=0
-} 
-
-//-----------------------------------------------------------------------------
-  void download_gif_file(TTY& bt, char *fileName)
-//-----------------------------------------------------------------------------
-{
-    const unsigned int MAXFILESIZE=50001;
-    static unsigned char fileData[MAXFILESIZE];
-    size_t fileSize;
-    unsigned short crcValue;
-    FILE *fp;
+    c.uploadData = data;
+    c.uploadSize = size;
+    c.seq->action(uploadBegin, &c);
+    // over when the device has checked it and is back at its menu
+    if (data) c.seq->upload(c.uploadName, data, size, optChunkedUpload);
+    else c.seq->upload(c.uploadName, optChunkedUpload);
+    c.seq->action(uploadEnd, &c);
+}
 
-    fp = fopen(fileName, "rb");
-    if (fp==NULL) {
-        printf("Command aborted - File '%s' not found\n", fileName);
-        return;
+
+//-----------------------------------------------------------------------------
+  static void uploadDone(void *context, ExpectResult result)
+//-----------------------------------------------------------------------------
+{
+    Cylinder *c = (Cylinder *)context;
+
+    release_gif_file(*c);
+    if (result == EXPECT_OK) c->device.sequenceDone();
+    else c->device.forget();
+    if (result == EXPECT_CANCELLED) printf("\n%sUpload cancelled\n", c->tag);
+}
+
+
+//-----------------------------------------------------------------------------
+  static bool rotationSet(void *context)
+//-----------------------------------------------------------------------------
+{
+    ((Cylinder *)context)->device.rotationIncrementSet(1);
+    return true;
+}
+
+
+//-----------------------------------------------------------------------------
+  static bool rotationUnknown(void *context)
+//-----------------------------------------------------------------------------
+{
+    ((Cylinder *)context)->device.rotationIncrementSet(-1);
+    return true;
+}
+
+
+//-----------------------------------------------------------------------------
+  static void queue_menu(Cylinder& c, bool show = true)
+//-----------------------------------------------------------------------------
+// start a new sequence: menu and, for a show, rotation increment 1 for an
+// external GIF, unless the device is known to be there already
+{
+    Expect *seq = c.seq;
+
+    seq->clear();
+    if (!c.device.isAtMenu()) {
+        seq->send("\r");
+        seq->expect(EXPECT_MENU, &histMenu, EXPECT_TIMEOUT_MS, EXPECT_RETRIES);
+    }
+    if (show && !c.device.hasRotationIncrement(1)) {
+        seq->send("s");                             // set rotation counter
+        seq->expect(EXPECT_PROMPT, &histPrompt);    // prompt for rotation increment
+        seq->send("1\r");                           // set to 1
+        seq->expect(EXPECT_MENU, &histMenu);
+        seq->action(rotationSet, &c);
     }
+}
 
-    fileSize = fread(fileData, 1, MAXFILESIZE, fp);
-    if (fileSize>=MAXFILESIZE) {
-        printf("Command aborted - Files size is greater than %d bytes\n", MAXFILESIZE-1);
-        fclose(fp);
-        return;
+
+//-----------------------------------------------------------------------------
+  static void queue_download(Cylinder& c)
+//-----------------------------------------------------------------------------
+// 'f' and a second for the device to get ready, upload of c.uploadName
+{
+    c.seq->send("f");
+    c.seq->delay(1000);
+    queue_upload(c);
+}
+
+
+//-----------------------------------------------------------------------------
+  static bool preflightRejected(void *context)
+//-----------------------------------------------------------------------------
+{
+    return false;
+}
+
+
+//-----------------------------------------------------------------------------
+  static void queue_show(Cylinder& c, const char *fileName, const char *preparedName)
+//-----------------------------------------------------------------------------
+// Set up the sequence that shows an external GIF: rotation increment 1,
+// upload, playback. Steps the device does not need are left out.
+// preparedName: file to upload, NULL: prepare fileName when it is needed
+{
+    Expect *seq = c.seq;
+
+    identify_upload(c, fileName);
+    c.showKey = c.uploadIdentified ? TUNE_KEY_FILE(c.uploadCrc, c.uploadSourceSize) : 0;
+    if (c.uploadIdentified && c.device.hasFile(c.uploadCrc, c.uploadSourceSize)) {
+        queue_menu(c);
+        printf("%sDevice already holds %s - no upload\n", c.tag, fileName);
     }
-    if (fileSize==0) {
-        printf("Command aborted - Error reading file\n");
-        fclose(fp);
-        return;
+    else {
+        // a playlist entry was checked when it was prepared
+        if (preparedName) strncpy(c.uploadName, preparedName, sizeof c.uploadName - 1);
+        else {
+            prepare_gif_file(c, fileName);
+            if (!preflight_check(c.uploadName, c.tag, fileName)) {
+                // nothing goes to the device, the sequence fails at once
+                seq->clear();
+                seq->action(preflightRejected, &c);
+                return;
+            }
+        }
+        queue_menu(c);
+        queue_download(c);
     }
-    crcValue = crc(fileData, fileSize);
-    printf("Downloading file %s - %lu bytes\n", fileName, fileSize);
-    printf("CRC: 0x%04X\n", crcValue);
-    // format: '&' start   - 1 byte
-    //         size        - 4 bytes
-    //         data[size]  - size byte
-    //         crc         - 2 bytes
-    bt.putChar('&');
-    bt.putData((unsigned char *)&fileSize, 4); 
-    bt.putData(fileData, fileSize); 
-    bt.putData((unsigned char *)&crcValue, 2); 
-    fclose(fp);
+    seq->send("x");
 }
 
 
 //-----------------------------------------------------------------------------
-  void cmd_download_gif_file(TTY& bt, KBD& kb, unsigned int nFiles, char *fileNames[])
+  bool cmd_download_gif_file(Cylinder& c, unsigned int nFiles, char *fileNames[])
 //-----------------------------------------------------------------------------
+// 'f' key: list the files of the command line, the next key selects one
+// (download_selected_file()). Nothing goes to the device before that.
+// Return value: true if the selection key is expected
 {
     unsigned int i;
     
-    printf("\nDownload GIF file\n");
+    printf("\n%sDownload GIF file\n", c.tag);
     if (nFiles==0) {
         printf("No GIF files provided in command line\n");
-        return;
+        return false;
     }
-    bt.putChar('f');
     if (nFiles>26) nFiles=26;
     printf("Please select file to be downloaded (a-%c)\n", (char)(nFiles-1+'a'));
     for (i=0; i<nFiles; i++)
         printf("%c = %s\n", (char) ('a'+i), fileNames[i]);
+    return true;
+}
+
 
-    i = kb.getch() - 'a';
+//-----------------------------------------------------------------------------
+  void download_selected_file(Cylinder& c, int key, unsigned int nFiles, char *fileNames[])
+//-----------------------------------------------------------------------------
+// the file is checked first, only then the device is switched to download
+{
+    unsigned int i = key - 'a';
+
+    if (nFiles>26) nFiles=26;
     if (i >= nFiles) {
         printf("Command aborted - Illegal file index\n");
         return;
     }
-    download_gif_file(bt, fileNames[i]);
+    if (c.seq->isBusy()) {
+        printf("%sCommand sequence running - download aborted\n", c.tag);
+        return;
+    }
+    identify_upload(c, fileNames[i]);
+    prepare_gif_file(c, fileNames[i]);
+    if (!preflight_check(c.uploadName, c.tag, fileNames[i])) {
+        release_gif_file(c);
+        return;
+    }
+    queue_menu(c, false);
+    queue_download(c);
+    c.seq->start(uploadDone, &c);
 }
 
 
-static Motor motor;
-static bool optAutomaticMotorControlEnable = false;
-static bool optMotorDisabled = true;
 
 //-----------------------------------------------------------------------------
-  void motorCommand(char ch)
+  static void wantedFreq(Cylinder& c, double freq)
 //-----------------------------------------------------------------------------
+// with automatic control the duty cycle goes straight to the learned one
 {
-    if (optMotorDisabled) {
-        printf("Motor has been disabled with -d command line option\n");
+    if (c.automaticMotorControl) c.motor.warmStart(freq);
+    else c.motor.setWantedFreq(freq);
+}
+
+
+//-----------------------------------------------------------------------------
+  void motorCommand(Cylinder& c, char ch)
+//-----------------------------------------------------------------------------
+{
+    Motor& motor = c.motor;
+
+    if (!c.motorServer[0]) {
+        printf("%sMotor control via TCP/IP is not enabled (-m)\n", c.tag);
         return;
     }
     switch (ch) {
@@ -404,22 +529,28 @@ static bool optMotorDisabled = true;
             motor.setDutyCycle((ch-'0')*10.00);
             // fall into disable motor control
         case 'd':
-            optAutomaticMotorControlEnable = false;
+            c.automaticMotorControl = false;
             break;
         case 'e':
-            optAutomaticMotorControlEnable = true;
+            c.automaticMotorControl = true;
+            break;
+        case 'p':
+            motor.setControlMode(Motor::CONTROL_PID);
+            break;
+        case 's':
+            motor.setControlMode(Motor::CONTROL_STEP);
             break;
         case 'F':
-            motor.setWantedFreq(21.00);
+            wantedFreq(c, 21.00);
             break;
         case 'f':
-            motor.setWantedFreq(16.00);
+            wantedFreq(c, 16.00);
             break;
         case '+':
-            motor.setWantedFreq(motor.getWantedFreq()+0.2);
+            wantedFreq(c, motor.getWantedFreq()+0.2);
             break;
         case '-':
-            motor.setWantedFreq(motor.getWantedFreq()-0.2);
+            wantedFreq(c, motor.getWantedFreq()-0.2);
             break;
         case 'h':
             printf("Alt-0..9: Set Duty Cycle to 0..90%% & disable motor control\n");
@@ -427,119 +558,678 @@ static bool optMotorDisabled = true;
             printf("Alt-d: Disable automatic motor control\n");
             printf("Alt-+: Increase wanted frequency by 0.2 Hz\n");
             printf("Alt--: Decrease wanted frequency by 0.2 Hz\n");
+            printf("Alt-p: Use PID speed controller with feedforward\n");
+            printf("Alt-s: Use step speed controller\n");
             break;
     }
     printf("\n");
+    if (c.tag[0]) printf("    Cylinder:                %s\n", c.name);
+    printf("    Motor server:            %s\n", motor.getLinkStateName());
     printf("    Motor duty cycle:        %5.2f %%\n", motor.getDutyCycle());
     printf("    Wanted motor frequency:  %5.2f Hz\n", motor.getWantedFreq());
-    printf("    Automatic motor control: %s\n", optAutomaticMotorControlEnable ? "enabled" : "disabled");
+    printf("    Automatic motor control: %s\n", c.automaticMotorControl ? "enabled" : "disabled");
+    printf("    Speed controller:        %s\n", motor.getControlMode() == Motor::CONTROL_PID ? "PID" : "step");
+    if (c.autoTune) printf("    Auto-tune:               %s\n", c.automaticMotorControl ? c.tuner.getStateName() : "off (no automatic motor control)");
+    if (motor.getSettlingTime() >= 0.)
+        printf("    Settled after %.1f s, jitter %.3f Hz rms\n", motor.getSettlingTime(), motor.getJitter());
+    else
+        printf("    Not settled yet\n");
+}
+//-----------------------------------------------------------------------------
+  void inbandFrame(Cylinder& c, const TelemetryEvent& ev)
+//-----------------------------------------------------------------------------
+// handle special inband information {<header><value>}
+{
+    if (!ev.numeric) return;
+    switch (ev.type) {
+        case 'p': 
+            c.period = ev.value;             
+            c.stream.setPeriod(c.period);
+            if (c.motorServer[0] && c.automaticMotorControl) c.motor.control(c.period);
+            if (c.autoTune && c.automaticMotorControl) c.tuner.rotationPeriod(c.period);
+            break;
+        case 's': 
+            c.numSkippedColumns = ev.value;   
+            c.stream.skippedColumns(c.numSkippedColumns);
+            if (c.autoTune && c.automaticMotorControl) c.tuner.skippedColumns(c.numSkippedColumns);
+            break;
+        case 'c': 
+            c.rotationCounter = ev.value;   
+            break;
+        default:
+            return;
+    }
+    c.recorder.record(ev.type, ev.value);
+    server.publish("telemetry %s %c %u", c.name, ev.type, ev.value);
+    printf("\r%s%u rotations: %5.2fHz = %uus (%d columns skipped)        ",
+           c.tag, c.rotationCounter, 1e6/c.period, c.period, c.numSkippedColumns);
+}
+
+//-----------------------------------------------------------------------------
+  static void printText(Cylinder& c, const char *text, unsigned int length)
+//-----------------------------------------------------------------------------
+// console text; with several cylinders every line starts with the name
+{
+    while (c.tag[0] && length > 0) {
+        const char *nl = (const char *)memchr(text, '\n', length);
+        unsigned int n = nl ? nl - text + 1 : length;
+        if (c.lineStart) fputs(c.tag, stdout);
+        fwrite(text, 1, n, stdout);
+        c.lineStart = nl != NULL;
+        text += n;
+        length -= n;
+    }
+    fwrite(text, 1, length, stdout);
 }
+
 //-----------------------------------------------------------------------------
-   int getNextChar(TTY& bt)
+  void telemetryEvent(void *context, const TelemetryEvent& ev)
 //-----------------------------------------------------------------------------
+// everything a cylinder sends ends up here
 {
-    char ch;
-    ch = bt.getChar();
-    //Hz / 57143 us
-    // decode special inband information
-    // Formats:
-    //     {p<rotation_period_in_us>}
-    //     {s<number_of_skipped_columns>}
-    // c=p:
-    if (ch!='{') printf("%c", ch);
+    Cylinder& c = *(Cylinder *)context;
+
+    if (ev.type) {
+        // replies of a chunked upload belong to the running sequence
+        if (c.seq && (ev.numeric || ev.length == 0) && c.seq->frame(ev.type, ev.value)) return;
+        inbandFrame(c, ev);
+        return;
+    }
+    printText(c, ev.text, ev.length);
+    if (c.keyTime && ev.length) {
+        histKeyEcho.record(now_us() - c.keyTime);
+        c.keyTime = 0;
+    }
+    if (c.seq) c.seq->feed(ev.text, ev.length);
+}
+
+#define BAUD_REPLY_TIMEOUT_MS 1000
+
+//-----------------------------------------------------------------------------
+  static bool discardInput(void *context)
+//-----------------------------------------------------------------------------
+{
+    ((TTY *)context)->discardInput();
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+  static bool checkLink(Cylinder& c, int delay_ms)
+//-----------------------------------------------------------------------------
+// after a baud rate switch: drop the garbage, a CR must bring up the menu
+{
+    c.seq->clear();
+    c.seq->delay(delay_ms);
+    c.seq->action(discardInput, c.bt);
+    c.seq->send("\r");
+    c.seq->expect(EXPECT_MENU, &histMenu, BAUD_REPLY_TIMEOUT_MS);
+    return c.seq->run(c.telemetry) == EXPECT_OK;
+}
+
+//-----------------------------------------------------------------------------
+  bool changeBaudRate(Cylinder& c, int baud)
+//-----------------------------------------------------------------------------
+// Switch device and host to baud with the device's 'B' command (see tty.h)
+// and check the link: a CR at the new rate must bring up the menu.
+// Otherwise both sides go back to the old rate.
+{
+    static Histogram histBaud("baud rate change", "us");
+    TTY& bt = *c.bt;
+    Expect *seq = c.seq;
+    int oldBaud = bt.getBaudRate();
+    long long tSwitch;
+    char text[16];
+
+    seq->clear();
+    seq->send("B");
+    seq->expect(EXPECT_PROMPT, &histPrompt, BAUD_REPLY_TIMEOUT_MS);
+    if (seq->run(c.telemetry) != EXPECT_OK) {
+        printf("\n%sDevice does not support baud rate changes\n", c.tag);
+        checkLink(c, 0);
+        return false;
+    }
+    sprintf(text, "%d\r", baud);
+    seq->clear();
+    seq->send(text);
+    seq->expect("baud\n", &histBaud, BAUD_REPLY_TIMEOUT_MS);
+    if (seq->run(c.telemetry) != EXPECT_OK) return false;
+    tSwitch = now_ms();
+
+    if (bt.setBaudRate(baud)) {
+        if (checkLink(c, 50)) return true;      // the device switches after its reply
+        bt.setBaudRate(oldBaud);
+    }
+
+    // wait for the device to fall back, then check the old rate
+    printf("\n%sNo response at %d baud - back to %d baud\n", c.tag, baud, oldBaud);
+    if (!checkLink(c, tSwitch + TTY_BAUD_CONFIRM_MS + 100 - now_ms()))
+        printf("%sNo response at %d baud either\n", c.tag, oldBaud);
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+  void probeBaudRate(Cylinder& c, int maxBaud)
+//-----------------------------------------------------------------------------
+// step the link rate up until the link or the adapter fails or maxBaud is reached
+{
+    static const int rates[] = { 19200, 38400, 57600, 115200, 230400, 460800, 921600,
+                                 1000000, 1500000, 2000000, 3000000, 4000000 };
+    unsigned int i;
+
+    for (i = 0; i < sizeof rates / sizeof rates[0] && rates[i] <= maxBaud; i++) {
+        if (rates[i] <= c.bt->getBaudRate()) continue;
+        if (!changeBaudRate(c, rates[i])) break;
+    }
+    printf("\n%sLink running at %d baud\n", c.tag, c.bt->getBaudRate());
+}
+
+//-----------------------------------------------------------------------------
+  static void showStarted(Cylinder& c)
+//-----------------------------------------------------------------------------
+// c.showKey is on display now
+{
+    if (c.autoTune && c.automaticMotorControl) c.tuner.showStarted(c.showKey);
+}
+
+//-----------------------------------------------------------------------------
+  static void guiDone(void *context, ExpectResult result)
+//-----------------------------------------------------------------------------
+{
+    Cylinder *c = (Cylinder *)context;
+
+    release_gif_file(*c);
+    if (result == EXPECT_OK) c->device.sequenceDone();
+    else c->device.forget();
+    if (result == EXPECT_OK) {
+        histGuiCommand.record(now_us() - c->guiCommandTime);
+        showStarted(*c);
+    }
+    else if (result == EXPECT_CANCELLED) printf("\n%sGUI command cancelled\n", c->tag);
+    else printf("\n%sGUI command failed\n", c->tag);
+}
+
+//-----------------------------------------------------------------------------
+  static void playlistDone(void *context, ExpectResult result)
+//-----------------------------------------------------------------------------
+{
+    Cylinder *c = (Cylinder *)context;
+    Playlist *playlist = &c->playlist;
+
+    if (result == EXPECT_OK) c->device.sequenceDone();
+    else c->device.forget();
+    if (result == EXPECT_CANCELLED) {
+        printf("\n%sPlaylist stopped\n", c->tag);
+        playlist->stop();
+        return;
+    }
+    if (result != EXPECT_OK) printf("\n%sPlaylist: %s failed - keeping the previous show\n", c->tag, playlist->getPreparedName());
     else {
-        char header = bt.getChar();
-        const int MAXTEXT = 16;
-        char text[MAXTEXT];
-        int i=0;    
-        static unsigned int period;
-        static unsigned int numSkippedColumns;
-        static unsigned int rotationCounter;
-        
-        for (i=0; i < MAXTEXT-1; i++) {
-          ch = bt.getChar();
-          //printf("%c", ch);
-        if (ch=='}') break;
-          text[i] = ch;
-        }
-        text[i] = 0;
-        switch (header) {
-            case 'p': 
-                sscanf(text,"%u", &period);             
-                if (!optMotorDisabled && optAutomaticMotorControlEnable) motor.control(period);
-                break;
-            case 's': 
-                sscanf(text,"%u", &numSkippedColumns);   
-                break;
-            case 'c': 
-                sscanf(text,"%u", &rotationCounter);   
-                break;
+        if (!playlist->isFirstShow()) histPlaylistGap.record((now_ms() - playlist->getShowEnd()) * 1000);
+        showStarted(*c);
+    }
+    playlist->showStarted();
+    playlist->prepareNext();
+}
+
+//-----------------------------------------------------------------------------
+  void playlistShow(Cylinder& c)
+//-----------------------------------------------------------------------------
+// switch to the prepared show, then prepare the next one while it plays
+{
+    Playlist& playlist = c.playlist;
+
+    if (!playlist.isUploadNeeded()) {
+        playlist.showStarted();
+        playlist.prepareNext();
+        return;
+    }
+    printf("\n%sPlaylist: %s\n", c.tag, playlist.getPreparedName());
+    queue_show(c, playlist.getPreparedName(), playlist.getUploadName());
+    c.seq->start(playlistDone, &c);
+}
+
+//-----------------------------------------------------------------------------
+  static void streamDone(void *context, ExpectResult result)
+//-----------------------------------------------------------------------------
+{
+    Cylinder *c = (Cylinder *)context;
+
+    if (result == EXPECT_OK) {
+        c->device.sequenceDone();
+        histStreamFrame.record(now_us() - c->uploadStart);
+        showStarted(*c);
+        return;
+    }
+    c->device.forget();
+    if (result == EXPECT_CANCELLED) {
+        printf("\n%sStream stopped\n", c->tag);
+        c->stream.stop();
+    }
+    else printf("\n%sStream: frame failed - going on with the next one\n", c->tag);
+}
+
+//-----------------------------------------------------------------------------
+  static void streamFrame(Cylinder& c)
+//-----------------------------------------------------------------------------
+// Send the newest frame of the stream. It is uploaded after 'f' like any
+// other file, with -A right at the menu without 'f' and its delay, and
+// played with 'x'. A frame identical to the one on display costs nothing.
+{
+    const unsigned char *data;
+    size_t size;
+    const char *name = c.stream.takeFrame(&data, &size);
+
+    if (name == NULL) return;
+    c.uploadCrc = crc_finish(crc_update(crc_init(), data, size));
+    c.uploadSourceSize = size;
+    c.uploadIdentified = true;
+    if (c.device.hasFile(c.uploadCrc, c.uploadSourceSize)) return;
+    c.showKey = TUNE_KEY_STREAM;
+    strncpy(c.uploadName, name, sizeof c.uploadName - 1);
+    c.uploadTemp = false;
+    queue_menu(c);
+    if (!optMenuUpload) {
+        c.seq->send("f");
+        c.seq->delay(1000);
+    }
+    queue_upload(c, data, size);
+    c.seq->send("x");
+    c.seq->start(streamDone, &c);
+}
+
+//-----------------------------------------------------------------------------
+  static void guiCommand(Cylinder& c, int i, const char *filename, int rotinc, ExpectDone done)
+//-----------------------------------------------------------------------------
+// i >= 0: internal GIF #i, CCF_EXTERNAL_GIF: GIF file filename
+{
+    char text[16];
+    Expect *seq = c.seq;
+
+    if (c.playlist.isActive()) {
+        printf("%sPlaylist stopped by command\n", c.tag);
+        c.playlist.stop();
+    }
+    if (c.stream.isActive()) {
+        printf("%sStream stopped by command\n", c.tag);
+        c.stream.stop();
+    }
+    if (i>=0) {
+        c.showKey = TUNE_KEY_INTERNAL(i);
+        seq->clear();
+        seq->send("y");
+        seq->expect(EXPECT_PROMPT, &histPrompt);    // prompt for GIF picture
+        sprintf(text, "%c%c\r", i/10+'0', i%10+'0');
+        seq->send(text);                            // GIF picture index
+        seq->expect(EXPECT_PROMPT, &histPrompt);    // prompt for rotation increment
+        seq->send("\r");                            // use default rotation value
+        if (rotinc==0) {
+            seq->expect(EXPECT_PROMPT, &histPrompt);    // prompt for rotation value
+            seq->send("\r");
         }
-        printf("\r%u rotations: %5.2fHz = %uus (%d columns skipped)        ", rotationCounter, 1e6/period, period, numSkippedColumns);
+        seq->action(rotationUnknown, &c);           // the picture's increment is in use now
     }
-    fflush (stdout);
-    return ch;
+    else queue_show(c, filename, NULL);
+    seq->start(done, &c);
 }
 
+// API request in progress (see server.h): its answer comes when its
+// sequences are over, the next request waits for that; only status and
+// cancel don't wait
+static unsigned int apiClient;
+static int apiPending = 0;              // sequences still running
+static bool apiFailed;
+static long long apiStart;              // us
+
 //-----------------------------------------------------------------------------
-  void waitForPrompt(TTY& bt)
+  static void apiDone(void *context, ExpectResult result)
 //-----------------------------------------------------------------------------
-// wait for "]: " sequence
 {
-    char ch;
-    
-    for (;;) {
-        do {
-            ch=getNextChar(bt);
-        } while (ch != ']');
-        if (getNextChar(bt)!=':') continue;
-        if (getNextChar(bt)==' ') return;;
+    Cylinder *c = (Cylinder *)context;
+
+    release_gif_file(*c);
+    if (result == EXPECT_OK) {
+        c->device.sequenceDone();
+        showStarted(*c);
     }
+    else c->device.forget();
+    if (!c->apiRequest) return;
+    c->apiRequest = false;
+    if (result != EXPECT_OK) apiFailed = true;
+    if (--apiPending > 0) return;
+    histApi.record(now_us() - apiStart);
+    if (apiFailed) server.replyReserved(apiClient, "error command sequence %s", result == EXPECT_CANCELLED ? "cancelled" : "failed");
+    else server.replyReserved(apiClient, "ok %.1f ms", (now_us() - apiStart) / 1000.);
 }
 
 //-----------------------------------------------------------------------------
-  void waitForMenu(TTY& bt)
+  static bool apiExecute(unsigned int client, const char *request)
 //-----------------------------------------------------------------------------
-// wait for "]: " sequence
+// Requests, [@<cylinder>] limits one to a single cylinder:
+//     [@<cylinder>] gif <index> [<rotinc>]   internal GIF picture
+//     [@<cylinder>] show <file>              GIF file, uploaded if needed
+//     [@<cylinder>] freq <Hz>                wanted motor frequency
+//     [@<cylinder>] cancel                   stop running sequences
+//     [@<cylinder>] status
+//     subscribe                              telemetry <cylinder> <type> <value>
+// cancel and status are answered at once, the others wait for the answer
+// of the request before them.
+// Return value: false if the request has to wait for running sequences
 {
-    char ch;
-    
-    for (;;) {
-        do {
-            ch=getNextChar(bt);
-        } while (ch != 'c');
-        if (getNextChar(bt)!='e') continue;
-        if (getNextChar(bt)==10) return;
+    Cylinder *targets[PCCP_MAXCYLINDERS];
+    int nTargets = 0;
+    char buffer[SERVER_LINESIZE];
+    char *line = buffer;
+    char *cmd, *arg;
+    int i;
+
+    strcpy(buffer, request);        // a request that has to wait is parsed again
+    while (*line == ' ') line++;
+    if (*line == '@') {
+        char *name = strtok(line + 1, " ");
+        for (i = 0; i < nCylinders && strcmp(cylinders[i]->name, name ? name : ""); i++);
+        if (i == nCylinders) {
+            server.reply(client, "error unknown cylinder %s", name ? name : "");
+            return true;
+        }
+        targets[nTargets++] = cylinders[i];
+        cmd = strtok(NULL, " ");
+    }
+    else {
+        for (i = 0; i < nCylinders; i++) targets[nTargets++] = cylinders[i];
+        cmd = strtok(line, " ");
+    }
+    arg = strtok(NULL, "");
+    if (cmd == NULL) {
+        server.reply(client, "error empty request");
+        return true;
+    }
+
+    if (strcmp(cmd, "cancel") == 0) {
+        for (i = 0; i < nTargets; i++) targets[i]->seq->cancel();
+        server.reply(client, "ok");
+        return true;
+    }
+    if (strcmp(cmd, "status") == 0) {
+        char text[SERVER_LINESIZE] = "ok";
+        for (i = 0; i < nTargets; i++) {
+            Cylinder& c = *targets[i];
+            size_t len = strlen(text);
+            snprintf(text + len, sizeof text - len, "%s %s busy=%d baud=%d rotations=%u period=%u skipped=%u freq=%.2f",
+                     i ? ";" : "", c.name, c.seq->isBusy(), c.bt->getBaudRate(),
+                     c.rotationCounter, c.period, c.numSkippedColumns, c.motor.getWantedFreq());
+        }
+        server.reply(client, "%s", text);
+        return true;
+    }
+    if (apiPending > 0) return false;
+
+    if (strcmp(cmd, "subscribe") == 0) {
+        server.subscribe(client);
+        server.reply(client, "ok");
+    }
+    else if (strcmp(cmd, "freq") == 0) {
+        double freq = arg ? atof(arg) : 0.;
+        if (freq <= 0.) {
+            server.reply(client, "error freq <Hz>");
+            return true;
+        }
+        for (i = 0; i < nTargets; i++) wantedFreq(*targets[i], freq);
+        server.reply(client, "ok");
+    }
+    else if (strcmp(cmd, "gif") == 0 || strcmp(cmd, "show") == 0) {
+        int index = CCF_EXTERNAL_GIF, rotinc = 0;
+        if (cmd[0] == 'g') {
+            if (arg == NULL || sscanf(arg, "%d %d", &index, &rotinc) < 1 || index < 0 || index > 99) {
+                server.reply(client, "error gif <index> [<rotinc>]");
+                return true;
+            }
+        }
+        else if (arg == NULL) {
+            server.reply(client, "error show <file>");
+            return true;
+        }
+        for (i = 0; i < nTargets; i++)
+            if (targets[i]->seq->isBusy()) return false;
+        apiClient = client;
+        apiFailed = false;
+        apiStart = now_us();
+        apiPending = nTargets;
+        server.reserve(client);         // later answers to the client wait for this one
+        for (i = 0; i < nTargets; i++) {
+            targets[i]->apiRequest = true;
+            guiCommand(*targets[i], index, arg, rotinc, apiDone);
+        }
+    }
+    else server.reply(client, "error unknown command %s", cmd);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+  static bool apiOvertakes(const char *request)
+//-----------------------------------------------------------------------------
+// requests apiExecute() answers at once may pass one that waits
+{
+    char buffer[SERVER_LINESIZE];
+    char *cmd;
+
+    strcpy(buffer, request);
+    cmd = strtok(buffer, " ");
+    if (cmd && cmd[0] == '@') cmd = strtok(NULL, " ");
+    return cmd && (strcmp(cmd, "status") == 0 || strcmp(cmd, "cancel") == 0);
+}
+
+//-----------------------------------------------------------------------------
+  static bool load_config(const char *fileName, Cylinder& defaults)
+//-----------------------------------------------------------------------------
+// Multi-cylinder configuration, one cylinder per line, '#' starts a comment:
+//     <name> <serial device> [baud=<rate>] [maxbaud=<rate>] [flow]
+//            [motor=<host[:port]>] [auto] [tune] [pid] [playlist=<file>] [record=<file>]
+//            [stream=<source>] [duty=<file>]
+// Command line options are the defaults for every cylinder (-b -a -F -m -e
+// -T -p -D); the name of the cylinder is appended to a -D duty table.
+{
+    char line[1024];
+    int lineNo = 0;
+    FILE *fp;
+
+    fp = fopen(fileName, "r");
+    if (fp == NULL) {
+        printf("Configuration %s not found\n", fileName);
+        return false;
+    }
+    while (fgets(line, sizeof line, fp)) {
+        char *token, *comment;
+        Cylinder *c;
+
+        lineNo++;
+        if ((comment = strchr(line, '#')) != NULL) *comment = 0;
+        token = strtok(line, " \t\r\n");
+        if (token == NULL) continue;
+        if (nCylinders == PCCP_MAXCYLINDERS) {
+            printf("Configuration %s: more than %d cylinders\n", fileName, PCCP_MAXCYLINDERS);
+            fclose(fp);
+            return false;
+        }
+        c = new Cylinder;
+        strncpy(c->name, token, sizeof c->name - 1);
+        c->baud = defaults.baud;
+        c->maxBaud = defaults.maxBaud;
+        c->hwFlowControl = defaults.hwFlowControl;
+        c->automaticMotorControl = defaults.automaticMotorControl;
+        c->autoTune = defaults.autoTune;
+        c->motor.setControlMode(defaults.motor.getControlMode());
+        strcpy(c->motorServer, defaults.motorServer);
+        // every motor learns its own duty cycles
+        if (defaults.dutyTable[0]) snprintf(c->dutyTable, sizeof c->dutyTable, "%.200s-%s", defaults.dutyTable, c->name);
+        token = strtok(NULL, " \t\r\n");
+        if (token == NULL) {
+            printf("Configuration %s line %d: expected <name> <serial device> [options]\n", fileName, lineNo);
+            fclose(fp);
+            return false;
+        }
+        strncpy(c->ttyDevice, token, sizeof c->ttyDevice - 1);
+        while ((token = strtok(NULL, " \t\r\n")) != NULL) {
+            if (strncmp(token, "baud=", 5) == 0) c->baud = atoi(token + 5);
+            else if (strncmp(token, "maxbaud=", 8) == 0) c->maxBaud = atoi(token + 8);
+            else if (strcmp(token, "flow") == 0) c->hwFlowControl = true;
+            else if (strncmp(token, "motor=", 6) == 0) strncpy(c->motorServer, token + 6, sizeof c->motorServer - 1);
+            else if (strcmp(token, "auto") == 0) c->automaticMotorControl = true;
+            else if (strcmp(token, "tune") == 0) c->automaticMotorControl = c->autoTune = true;
+            else if (strcmp(token, "pid") == 0) c->motor.setControlMode(Motor::CONTROL_PID);
+            else if (strncmp(token, "playlist=", 9) == 0) strncpy(c->playlistName, token + 9, sizeof c->playlistName - 1);
+            else if (strncmp(token, "stream=", 7) == 0) strncpy(c->streamSource, token + 7, sizeof c->streamSource - 1);
+            else if (strncmp(token, "duty=", 5) == 0) strncpy(c->dutyTable, token + 5, sizeof c->dutyTable - 1);
+            else if (strncmp(token, "record=", 7) == 0) {
+                if (!c->recorder.open(token + 7)) {
+                    fclose(fp);
+                    return false;
+                }
+            }
+            else {
+                printf("Configuration %s line %d: unknown option %s\n", fileName, lineNo, token);
+                fclose(fp);
+                return false;
+            }
+        }
+        sprintf(c->tag, "[%s] ", c->name);
+        cylinders[nCylinders++] = c;
     }
+    fclose(fp);
+    if (nCylinders == 0) {
+        printf("Configuration %s has no cylinders\n", fileName);
+        return false;
+    }
+    printf("Configuration %s: %d cylinders\n", fileName, nCylinders);
+    return true;
 }
 
 //-----------------------------------------------------------------------------
   int main (int argc, char *argv[])
 //-----------------------------------------------------------------------------
 {
-    TTY bt("/dev/ttyS6");
-    KBD kb;
-    char *optionPtr = argv[1];
+    Cylinder *single = new Cylinder;    // command line settings
+    const char *configName = NULL;
+    const char *socketName = NULL;
+    char *optionPtr;
     char filename[256];
+    int i, n;
     
-    // process command line options
-    optAutomaticMotorControlEnable = false;
-    if (argc > 1 && *optionPtr++=='-') {
+    // process command line options (option groups like "-ec -t /dev/ttyS7")
+    while (argc > 1 && *(optionPtr = argv[1])++=='-') {
         argc--;
         argv++;
         for (;*optionPtr; optionPtr++) {
             switch (*optionPtr) {
-                    case 'e': optAutomaticMotorControlEnable = true;
+                    case 'e': single->automaticMotorControl = true;
+                              break;
+
+                    case 'T': single->automaticMotorControl = true;
+                              single->autoTune = true;
+                              break;
+
+                    case 'd': single->motorServer[0] = 0;
+                              single->automaticMotorControl = false;
+                              break;
+
+                    case 'c': optChunkedUpload = true;
+                              break;
+
+                    case 'l': if (argc < 2) break;
+                              strncpy(single->playlistName, argv[1], sizeof single->playlistName - 1);   // option argument
+                              argc--;
+                              argv++;
+                              break;
+
+                    case 'L': if (argc < 2) break;
+                              strncpy(single->streamSource, argv[1], sizeof single->streamSource - 1);   // option argument
+                              argc--;
+                              argv++;
+                              break;
+
+                    case 'z': optOptimizeGif = true;
+                              break;
+
+                    case 'A': optMenuUpload = true;
+                              break;
+
+                    case 'p': single->motor.setControlMode(Motor::CONTROL_PID);
+                              break;
+
+                    case 'm': if (argc < 2) break;
+                              strncpy(single->motorServer, argv[1], sizeof single->motorServer - 1);    // option argument
+                              argc--;
+                              argv++;
+                              break;
+
+                    case 'r': if (argc < 2) break;
+                              if (!single->recorder.open(argv[1])) exit(1);   // option argument
+                              argc--;
+                              argv++;
+                              break;
+
+                    case 'b': if (argc < 2) break;
+                              single->baud = atoi(argv[1]);   // option argument
+                              argc--;
+                              argv++;
+                              break;
+
+                    case 'a': if (argc < 2) break;
+                              single->maxBaud = atoi(argv[1]);    // option argument
+                              argc--;
+                              argv++;
+                              break;
+
+                    case 'F': single->hwFlowControl = true;
                               break;
 
-                    case 'd': optMotorDisabled = true;
-                              optAutomaticMotorControlEnable = false;
+                    case 't': if (argc < 2) break;
+                              strncpy(single->ttyDevice, argv[1], sizeof single->ttyDevice - 1);    // option argument
+                              argc--;
+                              argv++;
+                              break;
+
+                    case 'D': if (argc < 2) break;
+                              strncpy(single->dutyTable, argv[1], sizeof single->dutyTable - 1);    // option argument
+                              argc--;
+                              argv++;
+                              break;
+
+                    case 'S': if (argc < 2) break;
+                              socketName = argv[1];   // option argument
+                              argc--;
+                              argv++;
+                              break;
+
+                    case 'M': if (argc < 2) break;
+                              configName = argv[1];   // option argument
+                              argc--;
+                              argv++;
                               break;
 
                     case 'h': printf("Usage: bt [-options] [gif_files...]\n");
                               printf("Options are single characters after the '-':\n");
                               printf("   -e   Enable automatic motor control\n");
                               printf("   -d   Disable motor control via TCP/IP completely\n");
+                              printf("   -c   Use chunked upload protocol with per-chunk CRC\n");
+                              printf("   -z   Shrink GIF files losslessly before uploading them\n");
+                              printf("   -p   Use PID speed controller instead of step controller\n");
+                              printf("   -T   Run every show at the highest speed without skipped columns (implies -e)\n");
+                              printf("   -t <device>  Serial device (default /dev/ttyS6)\n");
+                              printf("   -m <host[:port]>  Enable motor control via TCP/IP server ([IPv6 address]:port)\n");
+                              printf("   -D <file>    Learned motor duty cycles (default $HOME/.pccp-duty, -<name> appended with -M)\n");
+                              printf("   -r <file>    Record telemetry to a binary ring file (see povrec)\n");
+                              printf("   -l <file>    Play the GIF files of a playlist (<seconds> <gif file> per line)\n");
+                              printf("   -L <source>  Stream live GIF frames from a pipe or numbered files (frame%%05d.gif)\n");
+                              printf("   -A   Upload stream frames right at the menu, without 'f' (needs firmware support)\n");
+                              printf("   -b <baud>    Baud rate of the serial link (default %d)\n", TTY_DEFAULT_BAUD);
+                              printf("   -a <baud>    Step the link rate up to at most <baud>, checking the link\n");
+                              printf("   -F   Use RTS/CTS hardware flow control\n");
+                              printf("   -M <file>    Drive several cylinders, one per line of <file>:\n");
+                              printf("                <name> <serial device> [baud=<rate>] [maxbaud=<rate>] [flow]\n");
+                              printf("                [motor=<host[:port]>] [auto] [tune] [pid] [playlist=<file>] [record=<file>]\n");
+                              printf("                [stream=<source>] [duty=<file>]\n");
+                              printf("                -b -a -F -m -e -T -p -D are the defaults for all of them\n");
+                              printf("   -S <path>    Accept commands on a Unix domain socket (see server.h)\n");
                               printf("   -h   Display this help text\n");
                               break;
 
@@ -549,64 +1239,237 @@ static bool optMotorDisabled = true;
         }
     }
 
+    if (configName == NULL) cylinders[nCylinders++] = single;
+    else if (!load_config(configName, *single)) exit(1);
+
+    for (i = 0; i < nCylinders; i++) {
+        Cylinder& c = *cylinders[i];
+        c.bt = new TTY(c.ttyDevice, c.baud, c.hwFlowControl);
+        c.seq = new Expect(*c.bt, c.tag);
+    }
+    // without a terminal on stdin (daemon) pccp runs without keyboard
+    KBD *kb = isatty(STDIN_FILENO) ? new KBD : NULL;
+    int selected = 0;                   // cylinder the keys go to
+    Cylinder *fileSelect = NULL;        // 'f' typed: the next key selects a file
+    if (socketName && !server.open(socketName)) exit(1);
+
     printf("Bluetooth terminal program for POV Cylinder\nPress '.' to quit\n\n");
-    if (!optMotorDisabled) {
-        motor.init();
-        motor.setDutyCycle(60.00);      // 60% duty cycle
+    if (nCylinders > 1) printf("Tab switches the keyboard to the next cylinder\n");
+    for (i = 0; i < nCylinders; i++) {
+        Cylinder& c = *cylinders[i];
+        if (c.motorServer[0]) {
+            // start at the duty cycle an earlier run learned for the wanted
+            // frequency; it is sent as soon as the motor server is connected
+            if (c.dutyTable[0] == 0 && getenv("HOME")) {
+                if (c.tag[0]) snprintf(c.dutyTable, sizeof c.dutyTable, "%s/.pccp-duty-%s", getenv("HOME"), c.name);
+                else snprintf(c.dutyTable, sizeof c.dutyTable, "%s/.pccp-duty", getenv("HOME"));
+            }
+            if (c.dutyTable[0] && !c.motor.loadTable(c.dutyTable))
+                printf("%sMotor duty cycle table %s cannot be read\n", c.tag, c.dutyTable);
+            c.motor.init(c.motorServer, c.tag);
+            c.motor.setDutyCycle(c.motor.getFeedForward(c.motor.getWantedFreq()));
+        }
     }
 
+    if (pipe(signalPipe) != 0) {
+        printf("pipe failed with error: %s\n", strerror(errno));
+        exit(1);
+    }
+    fcntl(signalPipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(signalPipe[1], F_SETFL, O_NONBLOCK);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = onSigUsr1;
+    sigaction(SIGUSR1, &sa, NULL);
+    sa.sa_handler = onSigTerm;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    for (i = 0; i < nCylinders; i++) {
+        Cylinder& c = *cylinders[i];
+        if (c.maxBaud > c.bt->getBaudRate()) probeBaudRate(c, c.maxBaud);
+        if (c.playlistName[0] && c.playlist.load(c.playlistName, optOptimizeGif, c.tag)) c.playlist.prepareNext();
+        if (c.streamSource[0] && c.stream.open(c.streamSource) && c.playlist.isActive()) {
+            printf("%sThe stream replaces the playlist\n", c.tag);
+            c.playlist.stop();
+        }
+    }
+
+    // Event loop: sleep in poll() until a serial link, the keyboard, a motor
+    // socket or the GUI command watcher has something to do.
+    CommandWatcher commandWatcher;
+    bool kbdOpen = kb != NULL;
+    unsigned int apiRequestClient = 0;
+    char apiRequest[SERVER_LINESIZE];
+    bool apiHeld = false;               // apiRequest waits for running sequences
+
     while (1)
     {
+        enum { FD_KBD, FD_GUI, FD_SIGNAL, FD_CYLINDERS };   // then FD_BT, FD_MOTOR, FD_STREAM per cylinder
+        struct pollfd fds[FD_CYLINDERS + 3*PCCP_MAXCYLINDERS + SERVER_MAXCLIENTS + 1];
+        int fdServer;
         char ch;
-        int i;
         int rotinc;
-        if (bt.isCharAvailable()) {
-            ch = getNextChar(bt);
+        int timeout;
+        bool busy = false;
+
+        fds[FD_KBD].fd = kbdOpen ? kb->getHandle() : -1;
+        timeout = -1;
+        for (i = 0; i < nCylinders; i++) {
+            Cylinder& c = *cylinders[i];
+            // timeouts and upload progress of the running command sequence;
+            // new GUI commands and playlist shows wait until it is over
+            c.seq->poll();
+            if (c.motorServer[0]) c.motor.poll();
+            fds[FD_CYLINDERS + 3*i].fd = c.bt->getHandle();
+            fds[FD_CYLINDERS + 3*i + 1].fd = c.motorServer[0] ? c.motor.getSocket() : -1;
+            fds[FD_CYLINDERS + 3*i + 2].fd = c.stream.getHandle();
+            if (c.seq->isBusy()) busy = true;
+        }
+        fds[FD_GUI].fd = busy ? -1 : commandWatcher.getHandle();
+        fds[FD_SIGNAL].fd = signalPipe[0];
+        n = FD_CYLINDERS + 3*nCylinders;
+        for (i=0; i<n; i++) {
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        fdServer = n;
+        n += server.getPollFds(&fds[fdServer]);
+        for (i = 0; i < nCylinders; i++) {
+            Cylinder& c = *cylinders[i];
+            int t;
+            if (c.motorServer[0]) {
+                // connect in progress, the next attempt or a server answer
+                fds[FD_CYLINDERS + 3*i + 1].events = c.motor.getPollEvents();
+                t = c.motor.getTimeout();
+                if (t >= 0 && (timeout < 0 || t < timeout)) timeout = t;
+            }
+            // send everything queued in this pass as one burst; if the driver
+            // buffer is full, finish it when the link becomes writable
+            if (c.bt->flush(0) > 0) fds[FD_CYLINDERS + 3*i].events |= POLLOUT;
+            if (c.seq->isBusy()) t = c.seq->getTimeout();
+            else if (c.stream.isActive()) t = c.stream.getTimeout();
+            else t = c.playlist.getTimeout();
+            if (t >= 0 && (timeout < 0 || t < timeout)) timeout = t;
         }
-        if (kb.kbhit()) {
-            ch = kb.getch();
+        if (!busy) {
+            int t = commandWatcher.getTimeout();
+            if (t >= 0 && (timeout < 0 || t < timeout)) timeout = t;
+        }
+        if (apiHeld && !busy) timeout = 0;     // the sequence it waited for is over
+        n = poll(fds, n, timeout);
+        if (fds[FD_SIGNAL].revents & POLLIN) {
+            char drain[16];
+            while (read(signalPipe[0], drain, sizeof drain) > 0);
+        }
+        if (dumpStats) {
+            dumpStats = 0;
+            Histogram::printAll();
+        }
+        if (quit) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            printf("poll failed with error: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        for (i = 0; i < nCylinders; i++) {
+            Cylinder& c = *cylinders[i];
+            struct pollfd *pfd = &fds[FD_CYLINDERS + 3*i];
+            if (pfd[0].revents & POLLOUT) c.bt->flush(0);
+            if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+                // one read() pulls the whole burst, the parser takes it in one go
+                char data[TTY_RXBUFSIZE];
+                n = c.bt->getData((unsigned char *)data, sizeof data);
+                c.telemetry.feed(data, n);
+                fflush (stdout);
+            }
+            if (pfd[1].revents & (POLLIN | POLLOUT | POLLHUP | POLLERR)) {
+                c.motor.handleInput();
+            }
+            // read the stream while a frame is on its way: newer frames replace older ones
+            if (pfd[2].revents & (POLLIN | POLLHUP | POLLERR)) {
+                c.stream.handleInput();
+            }
+        }
+        if (fds[FD_KBD].revents & (POLLIN | POLLHUP | POLLERR)) {
+            Cylinder& k = *cylinders[selected];
+            int c = kb->getch();
+            if (c == EOF) {
+                kbdOpen = false;    // stdin closed - keep serving the other sources
+                continue;
+            }
+            ch = c;
             if (ch==10) ch=13;
             //printf("\nKey pressed: %d [%c]\n", ch, ch);
             if (ch=='.') break;
-            if (ch=='f') cmd_download_gif_file(bt, kb, argc-1, &argv[1]);
-            else if (ch==27) motorCommand(kb.getch());
-            else bt.putChar(ch); 
+            if (fileSelect) {
+                download_selected_file(*fileSelect, ch, argc-1, &argv[1]);
+                fileSelect = NULL;
+            }
+            else if (ch==27) motorCommand(k, kb->getch());
+            else if (ch==KEY_CANCEL) k.seq->cancel();
+            else if (ch==KEY_NEXT && nCylinders > 1) {
+                selected = (selected + 1) % nCylinders;
+                printf("\nKeys go to %s\n", cylinders[selected]->name);
+            }
+            else if (k.seq->isBusy()) printf("\n%sCommand sequence running - Ctrl-X cancels it\n", k.tag);
+            else if (ch=='f') {
+                if (cmd_download_gif_file(k, argc-1, &argv[1])) fileSelect = &k;
+            }
+            else {
+                k.bt->putChar(ch); 
+                k.device.keyTyped(ch);
+                k.keyTime = now_us();
+            }
+        }
+
+        // API requests in order, each one as soon as its cylinders are free
+        server.handle(&fds[fdServer], SERVER_MAXCLIENTS + 1);
+        while (apiHeld || server.nextRequest(&apiRequestClient, apiRequest)) {
+            apiHeld = !apiExecute(apiRequestClient, apiRequest);
+            if (apiHeld) break;
         }
-        i=check_command_file(filename, &rotinc);
-        if (i>=0) {
-            bt.putChar('y');  
-
-            waitForPrompt(bt);      // wait for prompt for GIF picture
-            bt.putChar(i/10+'0');   // write GIF picture index
-            bt.putChar(i%10+'0'); 
-            bt.putChar(13);   
-
-            waitForPrompt(bt);     // wait for prompt for rotation increment           
-            bt.putChar(13);        // use default rotation value    
-            
-            if (rotinc==0) {
-                waitForPrompt(bt); // prompt for rotation value
-                bt.putChar(13);            
+        if (apiHeld) {
+            unsigned int client;
+            char request[SERVER_LINESIZE];
+            while (server.nextRequest(&client, request, apiOvertakes, apiRequestClient))
+                apiExecute(client, request);
+        }
+
+        // a GUI command goes to all cylinders, their uploads run side by side
+        if (busy) i=CCF_ERROR;
+        else if ((fds[FD_GUI].revents & POLLIN) || commandWatcher.getTimeout() == 0)
+            i=commandWatcher.check(filename, &rotinc);
+        else i=CCF_ERROR;
+        if (i!=CCF_ERROR) {
+            printf("\nGUI command '%s' (%.1f ms after write)\n", i>=0 ? "internal GIF" : filename, commandWatcher.getLatency());
+            histGuiDetect.record(commandWatcher.getLatency() * 1000.);
+            for (n = 0; n < nCylinders; n++) {
+                cylinders[n]->guiCommandTime = now_us() - (long long)(commandWatcher.getLatency() * 1000.);
+                guiCommand(*cylinders[n], i, filename, rotinc, guiDone);
             }
         }
-        else if (i==CCF_EXTERNAL_GIF) {
-              printf("\n");
-
-              bt.putChar(13);   
-              waitForMenu(bt);
-
-              bt.putChar('s');       // set rotation counter
-              waitForPrompt(bt);     // wait for prompt for rotation increment           
-              bt.putChar('1');       // set to 1
-              bt.putChar(13);   
-              waitForMenu(bt);
-
-              bt.putChar('f');
-              sleep(1);
-              download_gif_file(bt, filename);
-              waitForMenu(bt);
-              bt.putChar('x');                          
+
+        for (i = 0; i < nCylinders; i++) {
+            Cylinder& c = *cylinders[i];
+            if (c.seq->isBusy()) continue;
+            if (c.stream.isActive()) {
+                if (c.stream.getTimeout() == 0) streamFrame(c);
+            }
+            else if (c.playlist.isPreparing()) c.playlist.prepareStep();
+            else if (c.playlist.getTimeout() == 0) playlistShow(c);
         }
     }
+    Histogram::printAll();
+    for (i = 0; i < nCylinders; i++) {
+        Cylinder& c = *cylinders[i];
+        c.seq->cancel();
+        if (c.tag[0]) printf("%s\n", c.name);
+        c.bt->printStats();
+        c.stream.printStats();
+        if (c.motorServer[0]) c.motor.saveTable();
+    }
+    delete kb;
     return 0;        
 }    
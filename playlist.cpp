@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+
+#include "playlist.h"
+#include "gif.h"
+#include "preflight.h"
+#include "stats.h"
+
+//-----------------------------------------------------------------------------
+  Playlist::Playlist(void)
+//-----------------------------------------------------------------------------
+{
+    entries = NULL;
+    nEntries = 0;
+    current = prepared = preparing = -1;
+    tried = 0;
+    optimized = false;
+    tag = "";
+    uploadName[0] = 0;
+    uploadTemp = false;
+    uploadSize = 0;
+    optimize = false;
+    showEnd = 0;
+}
+
+//-----------------------------------------------------------------------------
+  Playlist::~Playlist(void)
+//-----------------------------------------------------------------------------
+{
+    stop();
+}
+
+//-----------------------------------------------------------------------------
+  bool Playlist::load(const char *fileName, bool optimizeGif, const char *tagText)
+//-----------------------------------------------------------------------------
+{
+    char line[512];
+    FILE *fp;
+    int lineNo = 0;
+
+    stop();
+    tag = tagText;
+    fp = fopen(fileName, "r");
+    if (fp == NULL) {
+        printf("%sPlaylist %s not found\n", tag, fileName);
+        return false;
+    }
+    entries = (PlaylistEntry *) malloc(PLAYLIST_MAXENTRIES * sizeof(PlaylistEntry));
+    if (entries == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    while (fgets(line, sizeof line, fp) && nEntries < PLAYLIST_MAXENTRIES) {
+        char *p, *end;
+        double seconds;
+        size_t len;
+
+        lineNo++;
+        if ((p = strchr(line, '#'))) *p = 0;
+        for (len = strlen(line); len > 0 && isspace((unsigned char)line[len-1]); len--) line[len-1] = 0;
+        for (p = line; isspace((unsigned char)*p); p++);
+        if (*p == 0) continue;
+
+        seconds = strtod(p, &end);
+        for (p = end; isspace((unsigned char)*p); p++);
+        if (end == line || seconds <= 0 || *p == 0 || strlen(p) >= sizeof entries[0].fileName) {
+            printf("%sPlaylist %s line %d: expected <seconds> <gif file>\n", tag, fileName, lineNo);
+            continue;
+        }
+        strcpy(entries[nEntries].fileName, p);
+        entries[nEntries].duration_ms = (long)(seconds * 1000);
+        nEntries++;
+    }
+    fclose(fp);
+    optimize = optimizeGif;
+    if (nEntries == 0) {
+        printf("%sPlaylist %s is empty\n", tag, fileName);
+        stop();
+        return false;
+    }
+    printf("%sPlaylist %s: %d shows\n", tag, fileName, nEntries);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+  void Playlist::release(void)
+//-----------------------------------------------------------------------------
+// forget the prepared upload
+{
+    if (uploadTemp) unlink(uploadName);
+    uploadTemp = false;
+    uploadName[0] = 0;
+    prepared = preparing = -1;
+}
+
+//-----------------------------------------------------------------------------
+  void Playlist::stop(void)
+//-----------------------------------------------------------------------------
+{
+    release();
+    free(entries);
+    entries = NULL;
+    nEntries = 0;
+    current = -1;
+}
+
+//-----------------------------------------------------------------------------
+  int Playlist::getTimeout(void)
+//-----------------------------------------------------------------------------
+// Return value: poll() timeout in ms until the next show is due,
+// 0: due now or a preparation step to do, -1: no playlist
+{
+    long long t;
+    if (nEntries == 0) return -1;
+    if (current < 0 || preparing >= 0) return 0;
+    t = showEnd - now_ms();
+    return t < 0 ? 0 : (int)t;
+}
+
+//-----------------------------------------------------------------------------
+  void Playlist::prepareNext(void)
+//-----------------------------------------------------------------------------
+// start preparing the entry after the current one, see prepareStep()
+{
+    release();
+    if (nEntries == 0) return;
+    preparing = (current + 1) % nEntries;
+    tried = 0;
+    optimized = false;
+}
+
+//-----------------------------------------------------------------------------
+  void Playlist::skip(void)
+//-----------------------------------------------------------------------------
+// the entry being prepared cannot be shown: go on with the one after it
+{
+    int i = preparing;
+
+    release();
+    if (++tried == nEntries) {
+        printf("\n%sPlaylist: no valid GIF file left - playlist stopped\n", tag);
+        stop();
+        return;
+    }
+    preparing = (i + 1) % nEntries;
+    optimized = false;
+}
+
+//-----------------------------------------------------------------------------
+  void Playlist::prepareStep(void)
+//-----------------------------------------------------------------------------
+// One step of the preparation: the -z optimization of an entry, or its
+// check. Invalid entries are skipped; when no entry of the list can be
+// shown the playlist stops.
+{
+    int i = preparing;
+    GifReport r;
+    FILE *fp;
+
+    if (i < 0) return;
+    if (i == current) {
+        // the list has a single valid entry: it stays on display
+        preparing = -1;
+        prepared = current;
+        return;
+    }
+
+    if (optimize && !optimized) {
+        char tempName[] = "/tmp/pccp-XXXXXX";
+        int fd = mkstemp(tempName);
+
+        optimized = true;
+        strcpy(uploadName, entries[i].fileName);
+        if (fd >= 0) {
+            close(fd);
+            if (gif_optimize(entries[i].fileName, tempName, &r) == GIF_OK) {
+                strcpy(uploadName, tempName);
+                uploadTemp = true;
+            }
+            else unlink(tempName);
+        }
+        return;
+    }
+    if (!optimize) strcpy(uploadName, entries[i].fileName);
+
+    // every frame is checked against the limits of the cylinder
+    if (!preflight_check(uploadName, tag, entries[i].fileName)) {
+        printf("%sPlaylist: skipping %s\n", tag, entries[i].fileName);
+        skip();
+        return;
+    }
+    if ((fp = fopen(uploadName, "rb")) == NULL) {
+        skip();
+        return;
+    }
+    fseek(fp, 0, SEEK_END);
+    uploadSize = ftell(fp);
+    fclose(fp);
+    preparing = -1;
+    prepared = i;
+    printf("\n%sPlaylist: next show %s (%lu bytes to upload)\n", tag, entries[i].fileName, (unsigned long)uploadSize);
+}
+
+//-----------------------------------------------------------------------------
+  void Playlist::showStarted(void)
+//-----------------------------------------------------------------------------
+// the prepared entry is on display now
+{
+    if (prepared < 0) return;
+    current = prepared;
+    showEnd = now_ms() + entries[current].duration_ms;
+}
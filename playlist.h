@@ -0,0 +1,63 @@
+#ifndef PLAYLIST_H
+#define PLAYLIST_H
+
+// Playlist of GIF files with display durations.
+//
+// File format, one show per line, '#' starts a comment:
+//     <seconds> <gif file>
+// The list repeats. While one show is on display the next entry is
+// validated (and with -z optimized), so switching only costs the transfer.
+// Entries that are not valid GIFs or fail the preflight check (preflight.h)
+// are skipped ahead of time.
+// Preparing runs in steps from the main loop (isPreparing(), prepareStep()):
+// one optimization or one check per step, so telemetry, keys and the motor
+// are served in between.
+
+#define PLAYLIST_MAXENTRIES 256
+
+struct PlaylistEntry
+{
+    char fileName[256];
+    long duration_ms;
+};
+
+//-----------------------------------------------------------------------------
+  class Playlist
+//-----------------------------------------------------------------------------
+{
+  private:
+    PlaylistEntry *entries;
+    int nEntries;
+    int current;                // entry on display, -1: none yet
+    int prepared;               // entry ready in uploadName, -1: none
+    int preparing;              // entry being prepared, -1: none
+    int tried;                  // entries looked at by this preparation
+    bool optimized;             // preparing: the -z step is done
+    char uploadName[256];       // file to upload: original or optimized copy
+    bool uploadTemp;            // uploadName is a temporary file
+    size_t uploadSize;
+    bool optimize;
+    long long showEnd;          // ms, time the current show is over
+    const char *tag;            // in front of messages, e.g. "[left] "
+    void release(void);
+    void skip(void);
+
+  public:
+     Playlist(void);
+    ~Playlist(void);
+     bool load(const char *fileName, bool optimizeGif, const char *tag = "");
+     void stop(void);
+     bool isActive(void) { return nEntries > 0; };
+     int getTimeout(void);
+     void prepareNext(void);
+     bool isPreparing(void) { return preparing >= 0; };
+     void prepareStep(void);
+     bool isUploadNeeded(void) { return prepared != current; };
+     bool isFirstShow(void) { return current < 0; };
+     const char *getUploadName(void) { return uploadName; };
+     const char *getPreparedName(void) { return prepared >= 0 ? entries[prepared].fileName : ""; };
+     long long getShowEnd(void) { return showEnd; };
+     void showStarted(void);
+};
+
+#endif
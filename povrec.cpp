@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "recorder.h"
+
+// Export a pccp telemetry recording (pccp -r <file>) as CSV.
+// Every sample becomes one row; the columns carry the latest value of each
+// frame type forward, so every row is a complete snapshot. A recording
+// pccp still writes to can be read: samples it overwrites while they are
+// read are left out and counted on stderr.
+
+//-----------------------------------------------------------------------------
+  int main(int argc, char *argv[])
+//-----------------------------------------------------------------------------
+{
+    Recorder rec;
+    RecorderSample s;
+    uint32_t period = 0, skipped = 0, counter = 0;
+    uint64_t i, first, head, lost = 0;
+    bool summary = false;
+
+    if (argc > 2 && strcmp(argv[1], "-s") == 0) {
+        summary = true;
+        argv++;
+        argc--;
+    }
+    if (argc != 2) {
+        printf("Usage: povrec [-s] <recording>\n");
+        printf("   -s   Print summary statistics instead of CSV\n");
+        return 1;
+    }
+    if (!rec.open(argv[1], 0, true)) return 1;
+
+    head = rec.getHead();
+    first = head - rec.getCount();
+    if (summary) {
+        double sum = 0, sum2 = 0, fmin = 1e9, fmax = 0;
+        int64_t tFirst = 0, tLast = 0;
+        uint64_t n = 0, np = 0, skippedSamples = 0;
+        for (i = first; i < head; i++) {
+            if (!rec.getSample(i, &s)) {
+                lost++;
+                continue;
+            }
+            if (n++ == 0) tFirst = s.time_us;
+            tLast = s.time_us;
+            if (s.type == 'p' && s.value) {
+                double f = 1e6 / s.value;
+                sum += f;
+                sum2 += f * f;
+                if (f < fmin) fmin = f;
+                if (f > fmax) fmax = f;
+                np++;
+            }
+            if (s.type == 's' && s.value) skippedSamples++;
+        }
+        printf("samples:            %llu\n", (unsigned long long)n);
+        if (n) printf("duration:           %.1f s\n", (tLast - tFirst) / 1e6);
+        if (np) {
+            double mean = sum / np;
+            printf("rotation frequency: %.3f Hz mean, %.4f Hz rms, %.3f..%.3f Hz\n",
+                   mean, np > 1 ? sqrt(sum2 / np - mean * mean) : 0., fmin, fmax);
+        }
+        printf("samples with skipped columns: %llu\n", (unsigned long long)skippedSamples);
+        if (lost) printf("samples overwritten while read: %llu\n", (unsigned long long)lost);
+        return 0;
+    }
+
+    printf("time_s,type,value,period_us,frequency_hz,skipped_columns,rotation_counter\n");
+    for (i = first; i < head; i++) {
+        if (!rec.getSample(i, &s)) {
+            lost++;
+            continue;
+        }
+        switch (s.type) {
+            case 'p': period = s.value; break;
+            case 's': skipped = s.value; break;
+            case 'c': counter = s.value; break;
+        }
+        printf("%lld.%06lld,%c,%u,%u,%.4f,%u,%u\n",
+               (long long)(s.time_us / 1000000), (long long)(s.time_us % 1000000),
+               s.type, s.value, period, period ? 1e6 / period : 0., skipped, counter);
+    }
+    if (lost) fprintf(stderr, "povrec: %llu samples overwritten while read\n", (unsigned long long)lost);
+    return 0;
+}
@@ -0,0 +1,687 @@
+#include <stdio.h>      // standard input / output functions
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <math.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "crc.h"
+#include "upload.h"
+#include "tty.h"          // baud rate change protocol
+
+// Simulator for the POV Cylinder on the other end of the serial link.
+// It creates a pseudo terminal; pccp is started with "-t <slave device>"
+// (or the pty is linked to /dev/ttyS6 with -l). It emulates
+//   - the command menu (ending in "...choice\n", see waitForMenu()),
+//   - the "...]: " prompts of the s, y and B commands (see waitForPrompt()),
+//   - {p..} {s..} {c..} telemetry at a configurable rate,
+//   - the '&' and '%' GIF downloads including the CRC check,
+// and it paces both directions to a baud rate and can drop or corrupt
+// bytes, so pccp latency and throughput can be measured under realistic
+// link conditions.
+//
+// With -m <port> it also stands in for the motor server: a TCP server that
+// takes a duty value 0..4095 and answers with a one byte error code (see
+// Motor::setDutyCycle()). The duty drives a flywheel model with inertia,
+// friction and supply noise whose rotation period is reported as {p..}.
+// With -K <Hz> the display skips columns ({s..}) above a rotation frequency
+// that goes down with the work per column of the picture shown.
+
+static int master;                  // pty master = the device side
+static int optBaud = 0;             // 0: no pacing
+static int optMaxBaud = 0;          // highest rate the adapter handles, 0: any
+static volatile bool linkGarbled = false;   // rate mismatch after 'B'
+static int optDropPermille = 0;     // lost bytes per 1000 bytes
+static int optCorruptPermille = 0;  // corrupted bytes per 1000 bytes
+static int optCorruptUploads = 0;   // '&' uploads received with a wrong byte
+static bool optMenuUpload = false;  // uploads are taken at the menu, without 'f'
+static double optTelemetryRate = 2; // {p}{s}{c} frames per second
+static unsigned int optPeriod = 57143;      // rotation period in us
+static unsigned int optJitter = 200;        // +/- us
+static unsigned int optSkipped = 0;         // skipped columns
+static double optSkipFreq = 0;      // Hz, columns are skipped above it, 0: never
+static bool optVerbose = false;
+static int optMotorPort = 0;        // 0: no motor server, fixed optPeriod
+static double optSupplyNoise = 2.0; // supply voltage noise in percent
+static unsigned int optSeed = 1;    // noise seed, for repeatable runs
+static bool optMotorLog = false;
+
+static const int rotIncDefault[25] = {
+    0, 0, 0, 0, 2, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 0, 0, 0, 0
+};
+static int rotationIncrement = 1;
+static bool externalGifValid = false;
+static unsigned long externalGifSize = 0;
+static double displayLoad = 0;      // Hz the picture shown takes off optSkipFreq
+
+//-----------------------------------------------------------------------------
+  static double now_s(void)
+//-----------------------------------------------------------------------------
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//-----------------------------------------------------------------------------
+  static void sleepUntil(double t)
+//-----------------------------------------------------------------------------
+{
+    double dt = t - now_s();
+    if (dt > 0) usleep((useconds_t)(dt * 1e6));
+}
+
+//-----------------------------------------------------------------------------
+  static bool injectError(unsigned char *ch)
+//-----------------------------------------------------------------------------
+// Return value: false if the byte is lost on the link
+{
+    if (optDropPermille && rand() % 1000 < optDropPermille) return false;
+    if (optCorruptPermille && rand() % 1000 < optCorruptPermille) *ch ^= 1 << (rand() % 8);
+    return true;
+}
+
+
+// Output to pccp: simPut() queues, the writer thread sends at optBaud.
+static const unsigned int OUTBUFSIZE = 65536;
+static unsigned char outBuf[OUTBUFSIZE];
+static unsigned int outHead, outTail;
+static pthread_mutex_t outLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t outCond = PTHREAD_COND_INITIALIZER;
+
+//-----------------------------------------------------------------------------
+  static void simPut(const char *text)
+//-----------------------------------------------------------------------------
+{
+    pthread_mutex_lock(&outLock);
+    for (; *text; text++) {
+        while (outHead - outTail == OUTBUFSIZE) pthread_cond_wait(&outCond, &outLock);
+        outBuf[outHead++ % OUTBUFSIZE] = *text;
+    }
+    pthread_cond_broadcast(&outCond);
+    pthread_mutex_unlock(&outLock);
+}
+
+//-----------------------------------------------------------------------------
+  static void simDrain(void)
+//-----------------------------------------------------------------------------
+// wait until everything queued by simPut() has left
+{
+    pthread_mutex_lock(&outLock);
+    while (outHead != outTail) pthread_cond_wait(&outCond, &outLock);
+    pthread_mutex_unlock(&outLock);
+    usleep(2000);           // the last chunk
+}
+
+//-----------------------------------------------------------------------------
+  static void *writerThread(void *)
+//-----------------------------------------------------------------------------
+{
+    unsigned char chunk[256];
+    double linkFree = now_s();
+
+    for (;;) {
+        unsigned int n, i, m = 0;
+
+        pthread_mutex_lock(&outLock);
+        while (outHead == outTail) pthread_cond_wait(&outCond, &outLock);
+        n = outHead - outTail;
+        if (n > sizeof chunk) n = sizeof chunk;
+        if (optBaud && n > (unsigned)optBaud / 1000 + 1) n = optBaud / 1000 + 1;  // ~1 ms
+        for (i = 0; i < n; i++) {
+            chunk[m] = outBuf[outTail++ % OUTBUFSIZE];
+            if (linkGarbled) chunk[m] = ~chunk[m] | 0x80;  // framing errors
+            if (injectError(&chunk[m])) m++;
+        }
+        pthread_cond_broadcast(&outCond);
+        pthread_mutex_unlock(&outLock);
+
+        if (optBaud) {
+            if (linkFree < now_s()) linkFree = now_s();
+            linkFree += n * 10.0 / optBaud;     // 8n1: 10 bit per byte
+            sleepUntil(linkFree);
+        }
+        for (i = 0; i < m; ) {
+            ssize_t w = write(master, chunk + i, m - i);
+            if (w > 0) i += w;
+            else if (w < 0 && errno == EAGAIN) usleep(1000);
+            else break;                         // pccp not connected: lost
+        }
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+  static int simGetByte(int timeout_ms)
+//-----------------------------------------------------------------------------
+// Return value: next byte from pccp after pacing and error injection,
+//               -1 on timeout
+{
+    static unsigned char buf[4096];
+    static int pos = 0, len = 0;
+    static double linkFree = 0;
+
+    for (;;) {
+        if (pos == len) {
+            struct pollfd pfd;
+            pfd.fd = master;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, timeout_ms) <= 0) return -1;
+            // never read ahead more than the link could have delivered,
+            // so a slow link pushes back into pccp's write queue
+            len = optBaud ? optBaud / 1000 + 1 : (int)sizeof buf;
+            if (len > (int)sizeof buf) len = sizeof buf;
+            len = read(master, buf, len);
+            pos = 0;
+            if (len <= 0) {
+                if (len < 0 && errno == EIO) usleep(10000);  // no slave open
+                len = 0;
+                return -1;
+            }
+        }
+        unsigned char ch = buf[pos++];
+        if (optBaud) {
+            if (linkFree < now_s() - 0.001) linkFree = now_s();
+            linkFree += 10.0 / optBaud;
+            sleepUntil(linkFree);
+        }
+        if (!injectError(&ch)) continue;
+        if (optVerbose) printf("%8.3f rx 0x%02X\n", now_s(), ch);
+        return ch;
+    }
+}
+
+// Flywheel model of the cylinder drive, frequency f in Hz:
+//     df/dt = A * duty * supply - B * f - C          (C only while turning)
+// i.e. f settles at (A*duty - C)/B = 30*duty - 2 Hz (16 Hz at 60 %, 21 Hz
+// at 76.7 %) with a time constant of 1/B = 4 s. The supply is a low pass
+// filtered random walk around 1.0.
+static const double MOTOR_A = 7.5, MOTOR_B = 0.25, MOTOR_C = 0.5;
+static double motorDuty = 0;        // 0..1
+static double motorFreq = 0;        // Hz
+static double motorRotations = 0;
+static pthread_mutex_t motorLock = PTHREAD_MUTEX_INITIALIZER;
+
+//-----------------------------------------------------------------------------
+  static double gaussian(unsigned int *seed)
+//-----------------------------------------------------------------------------
+{
+    double u1 = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+    double u2 = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+//-----------------------------------------------------------------------------
+  static void *physicsThread(void *)
+//-----------------------------------------------------------------------------
+{
+    const double DT = 0.001;
+    unsigned int seed = optSeed;
+    double supply = 1.0, t = now_s(), t0 = t, nextLog = t;
+
+    for (;;) {
+        double accel;
+
+        t += DT;
+        sleepUntil(t);
+        supply += (1.0 + optSupplyNoise / 100 * gaussian(&seed) * 3 - supply) * DT / 0.1;
+
+        pthread_mutex_lock(&motorLock);
+        accel = MOTOR_A * motorDuty * supply - MOTOR_B * motorFreq;
+        if (motorFreq > 0) accel -= MOTOR_C;
+        else if (accel < MOTOR_C) accel = 0;        // static friction
+        motorFreq += accel * DT;
+        if (motorFreq < 0) motorFreq = 0;
+        motorRotations += motorFreq * DT;
+        pthread_mutex_unlock(&motorLock);
+
+        if (optMotorLog && t >= nextLog) {
+            printf("motor: t=%7.1f s  duty=%5.1f %%  f=%6.3f Hz\n", t - t0, motorDuty * 100, motorFreq);
+            fflush(stdout);
+            nextLog += 1.0;
+        }
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+  static void *motorServerThread(void *)
+//-----------------------------------------------------------------------------
+// one client at a time, like the real motor server
+{
+    struct sockaddr_in addr;
+    int one = 1;
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(optMotorPort);
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    if (bind(server, (struct sockaddr *)&addr, sizeof addr) != 0 || listen(server, 1) != 0) {
+        printf("Cannot listen on port %d: %s\n", optMotorPort, strerror(errno));
+        exit(1);
+    }
+
+    for (;;) {
+        int client = accept(server, NULL, NULL);
+        char buf[16];
+        ssize_t n;
+
+        if (client < 0) continue;
+        if (optMotorLog) printf("motor: client connected\n");
+        while ((n = recv(client, buf, sizeof buf - 1, 0)) > 0) {
+            char *end;
+            long value;
+            char code = '0';
+
+            buf[n] = 0;
+            value = strtol(buf, &end, 10);
+            if (end == buf || *end) code = '1';                 // no valid integer
+            else if (value < 0 || value > 4095) code = '2';     // out of range
+            else {
+                pthread_mutex_lock(&motorLock);
+                motorDuty = value / 4096.0;
+                pthread_mutex_unlock(&motorLock);
+            }
+            send(client, &code, 1, 0);
+        }
+        if (optMotorLog) printf("motor: client disconnected\n");
+        close(client);
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+  static void *telemetryThread(void *)
+//-----------------------------------------------------------------------------
+{
+    double t = now_s();
+    double rotations = 0;
+    unsigned int period = optPeriod;
+
+    for (;;) {
+        char frame[64];
+        t += 1.0 / optTelemetryRate;
+        sleepUntil(t);
+        if (optMotorPort) {
+            pthread_mutex_lock(&motorLock);
+            // a standing cylinder reports the longest period it can measure
+            period = motorFreq > 1e6 / 0xFFFFFFFFu ? (unsigned int)(1e6 / motorFreq) : 0xFFFFFFFFu;
+            rotations = motorRotations;
+            pthread_mutex_unlock(&motorLock);
+        }
+        else {
+            period = optPeriod + (optJitter ? rand() % (2*optJitter+1) - optJitter : 0);
+            rotations += 1e6 / optTelemetryRate / period;
+        }
+        unsigned int skipped = optSkipped;
+        double limit = optSkipFreq - displayLoad;
+        if (optSkipFreq > 0 && 1e6 / period > limit) skipped += (unsigned int)((1e6 / period - limit) * 20) + 1;
+        sprintf(frame, "{p%u}{s%u}{c%u}", period, skipped, (unsigned int)rotations);
+        simPut(frame);
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+  static int readNumber(const char *prompt, int defaultValue)
+//-----------------------------------------------------------------------------
+// print prompt "...[default]: " and read a decimal number terminated by CR
+{
+    char text[80];
+    int value = 0, digits = 0, c;
+
+    sprintf(text, "%s [%d]: ", prompt, defaultValue);
+    simPut(text);
+    while ((c = simGetByte(60000)) >= 0 && c != 13) {
+        if (c >= '0' && c <= '9') {
+            value = value * 10 + c - '0';
+            digits++;
+            text[0] = c;
+            text[1] = 0;
+            simPut(text);   // echo
+        }
+    }
+    simPut("\n");
+    return digits ? value : defaultValue;
+}
+
+//-----------------------------------------------------------------------------
+  static void printMenu(void)
+//-----------------------------------------------------------------------------
+{
+    simPut("\n"
+           "POV Cylinder\n"
+           "0-7 - fill screen with color\n"
+           "t - draw triangle curve\n"
+           "s - set rotation increment\n"
+           "r - draw single row\n"
+           "c - draw single column\n"
+           "y - playback internal GIF picture\n"
+           "f - download external GIF file\n"
+           "x - playback downloaded external GIF file\n"
+           "Enter your choice\n");
+}
+
+//-----------------------------------------------------------------------------
+  static bool receiveLegacy(void)
+//-----------------------------------------------------------------------------
+// '&' size[4] data[size] crc[2]
+{
+    unsigned char hdr[4];
+    unsigned long size, i;
+    unsigned short crcValue = crc_init(), crcRx;
+    double t0 = now_s();
+    int c;
+
+    for (i = 0; i < 4; i++) {
+        if ((c = simGetByte(2000)) < 0) { printf("'&' upload: timeout in size\n"); return false; }
+        hdr[i] = c;
+    }
+    size = hdr[0] | hdr[1] << 8 | hdr[2] << 16 | (unsigned long)hdr[3] << 24;
+    for (i = 0; i < size; i++) {
+        if ((c = simGetByte(2000)) < 0) break;
+        unsigned char b = c;
+        if (optCorruptUploads > 0 && i == size / 2) b ^= 0x55;
+        crcValue = crc_update(crcValue, &b, 1);
+    }
+    if (i == size && optCorruptUploads > 0) optCorruptUploads--;
+    if (i < size) {
+        printf("'&' upload: timeout after %lu of %lu bytes\n", i, size);
+        simPut("Download timeout\n");
+        return false;
+    }
+    crcRx = simGetByte(2000);
+    crcRx |= simGetByte(2000) << 8;
+    crcValue = crc_finish(crcValue);
+    printf("'&' upload: %lu bytes in %.2f s, CRC 0x%04X %s\n", size, now_s() - t0, crcValue,
+           crcRx == crcValue ? "ok" : "ERROR");
+    simPut(crcRx == crcValue ? "Download ok\n" : "CRC error\n");
+    if (crcRx == crcValue) externalGifSize = size;
+    return crcRx == crcValue;
+}
+
+//-----------------------------------------------------------------------------
+  static bool receiveChunked(void)
+//-----------------------------------------------------------------------------
+// "%<size>,<chunksize>,<window>\r" followed by STX/EOT frames, see upload.h
+{
+    char line[48], reply[24];
+    unsigned long size, nChunks, received = 0, naks = 0;
+    unsigned int chunkSize, window;
+    unsigned char *file;
+    bool *have;
+    static unsigned char in[2 * (7 + UPLOAD_MAXCHUNKSIZE)];
+    double t0 = now_s();
+    int inLen = 0, i, c = -1;
+
+    for (i = 0; i < (int)sizeof line - 1; i++) {
+        if ((c = simGetByte(1000)) < 0 || c == '\r') break;
+        line[i] = c;
+    }
+    line[i] = 0;
+    if (c != '\r' || sscanf(line, "%lu,%u,%u", &size, &chunkSize, &window) != 3 ||
+        size == 0 || chunkSize == 0 || chunkSize > UPLOAD_MAXCHUNKSIZE) {
+        printf("'%%' upload: bad start line '%s'\n", line);
+        return false;
+    }
+    nChunks = (size + chunkSize - 1) / chunkSize;
+    file = (unsigned char *) malloc(size);
+    have = (bool *) calloc(nChunks, sizeof(bool));
+    simPut("{r}");
+
+    for (;;) {
+        // fill the frame buffer; a gap in the data means a frame lost bytes
+        if ((c = simGetByte(inLen ? 300 : 10000)) < 0) {
+            if (inLen == 0) { printf("'%%' upload: host went away\n"); break; }
+            memmove(in, in+1, --inLen);
+        }
+        else {
+            if (inLen == (int)sizeof in) memmove(in, in+1, --inLen);
+            in[inLen++] = c;
+        }
+
+        // parse as many frames as possible, dropping one byte to resync
+        while (inLen > 0) {
+            if (in[0] == '%' && received == 0) {
+                // repeated start line: our {r} got lost
+                simPut("{r}");
+                memmove(in, in+1, --inLen);
+                continue;
+            }
+            if (in[0] == UPLOAD_EOT) {
+                if (inLen < 5) break;
+                unsigned short crcRx = in[1] | in[2] << 8;
+                if ((in[3] ^ in[1]) != 0xFF || (in[4] ^ in[2]) != 0xFF) {
+                    memmove(in, in+1, --inLen);
+                    continue;
+                }
+                unsigned short crcValue = crc_finish(crc_update(crc_init(), file, size));
+                bool ok = received == nChunks && crcValue == crcRx;
+                simPut(ok ? "{d0}" : "{d1}");
+                if (ok) externalGifSize = size;
+                printf("'%%' upload: %lu bytes in %lu chunks in %.2f s, %lu naks, CRC 0x%04X %s\n",
+                       size, nChunks, now_s() - t0, naks, crcValue, ok ? "ok" : "ERROR");
+                free(file);
+                free(have);
+                return ok;
+            }
+            if (in[0] != UPLOAD_STX) {
+                memmove(in, in+1, --inLen);
+                continue;
+            }
+            if (inLen < 5) break;
+            unsigned int seq = in[1] | in[2] << 8;
+            unsigned int len = in[3] | in[4] << 8;
+            if (seq >= nChunks || len > chunkSize) {
+                memmove(in, in+1, --inLen);
+                continue;
+            }
+            if (inLen < (int)(7 + len)) break;
+            unsigned short crcRx = in[5+len] | in[6+len] << 8;
+            if (crc_finish(crc_update(crc_init(), &in[1], 4 + len)) == crcRx) {
+                memcpy(&file[(size_t)seq * chunkSize], &in[5], len);
+                if (!have[seq]) received++;
+                have[seq] = true;
+                sprintf(reply, "{a%u}", seq & 0xFFFF);
+                memmove(in, in + 7 + len, inLen -= 7 + len);
+            }
+            else {
+                naks++;
+                sprintf(reply, "{n%u}", seq & 0xFFFF);
+                memmove(in, in+1, --inLen);
+            }
+            simPut(reply);
+        }
+    }
+    free(file);
+    free(have);
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+  static void changeBaudRate(void)
+//-----------------------------------------------------------------------------
+// 'B': switch to a new rate, fall back unless a CR arrives at the new rate
+// within TTY_BAUD_CONFIRM_MS. Rates above -B are garbled: nothing gets
+// through in either direction.
+{
+    char text[80];
+    int oldBaud = optBaud;
+    int baud = readNumber("Baud rate", optBaud ? optBaud : TTY_DEFAULT_BAUD);
+    bool garbled = optMaxBaud && baud > optMaxBaud;
+    double deadline;
+    int c;
+
+    sprintf(text, "Switching to %d baud\n", baud);
+    simPut(text);
+    simDrain();
+    optBaud = baud;
+    linkGarbled = garbled;
+    deadline = now_s() + TTY_BAUD_CONFIRM_MS / 1000.;
+    while (now_s() < deadline) {
+        c = simGetByte((int)((deadline - now_s()) * 1000) + 1);
+        if (c == 13 && !garbled) return;
+    }
+    optBaud = oldBaud;
+    linkGarbled = false;
+    sprintf(text, "No confirmation - back to %d baud\n", oldBaud ? oldBaud : TTY_DEFAULT_BAUD);
+    simPut(text);
+}
+
+//-----------------------------------------------------------------------------
+  static void command(int c)
+//-----------------------------------------------------------------------------
+// one menu command
+{
+    char text[80];
+    int i, inc;
+
+    switch (c) {
+        case '0': case '1': case '2': case '3':
+        case '4': case '5': case '6': case '7':
+            sprintf(text, "Fill screen with color %c\n", c);
+            simPut(text);
+            break;
+        case 't': simPut("Triangle curve\n"); break;
+        case 'r': simPut("Single row\n"); break;
+        case 'c': simPut("Single column\n"); break;
+        case 's':
+            rotationIncrement = readNumber("Rotation increment", rotationIncrement);
+            break;
+        case 'y':
+            i = readNumber("GIF picture index (0-24)", 0);
+            if (i < 0 || i > 24) {
+                simPut("Illegal index\n");
+                break;
+            }
+            inc = readNumber("Rotation increment", rotIncDefault[i]);
+            if (inc == 0) readNumber("Rotation value", 10);
+            rotationIncrement = inc;
+            displayLoad = 0.2 * i;
+            sprintf(text, "Playback of internal GIF %d\n", i);
+            simPut(text);
+            break;
+        case 'f':
+            simPut("Waiting for GIF file\n");
+            for (;;) {
+                c = simGetByte(30000);
+                if (c == '&') { externalGifValid = receiveLegacy(); break; }
+                if (c == '%') { externalGifValid = receiveChunked(); break; }
+                if (c < 0) { simPut("Download timeout\n"); break; }
+            }
+            break;
+        case 'B':
+            changeBaudRate();
+            break;
+        case 'x':
+            simPut(externalGifValid ? "Playback of downloaded GIF\n" : "No GIF file downloaded\n");
+            if (externalGifValid) displayLoad = externalGifSize / 2048.;     // 1 Hz per 2 KB
+            break;
+        case '&':           // with -A downloads without 'f' are accepted as well
+            if (!optMenuUpload) return;
+            externalGifValid = receiveLegacy();
+            break;
+        case '%':
+            if (!optMenuUpload) return;
+            externalGifValid = receiveChunked();
+            break;
+        case 13:
+        case ' ':
+            break;
+        default:
+            return;         // unknown keys are ignored
+    }
+    printMenu();
+}
+
+//-----------------------------------------------------------------------------
+  int main(int argc, char *argv[])
+//-----------------------------------------------------------------------------
+{
+    const char *link = NULL;
+    pthread_t thread;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-l") == 0 && i+1 < argc) link = argv[++i];
+        else if (strcmp(argv[i], "-b") == 0 && i+1 < argc) optBaud = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-B") == 0 && i+1 < argc) optMaxBaud = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-D") == 0 && i+1 < argc) optDropPermille = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-X") == 0 && i+1 < argc) optCorruptPermille = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-C") == 0 && i+1 < argc) optCorruptUploads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0 && i+1 < argc) optTelemetryRate = atof(argv[++i]);
+        else if (strcmp(argv[i], "-p") == 0 && i+1 < argc) optPeriod = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-j") == 0 && i+1 < argc) optJitter = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-k") == 0 && i+1 < argc) optSkipped = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-K") == 0 && i+1 < argc) optSkipFreq = atof(argv[++i]);
+        else if (strcmp(argv[i], "-m") == 0 && i+1 < argc) optMotorPort = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i+1 < argc) optSupplyNoise = atof(argv[++i]);
+        else if (strcmp(argv[i], "-S") == 0 && i+1 < argc) optSeed = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-M") == 0) optMotorLog = true;
+        else if (strcmp(argv[i], "-A") == 0) optMenuUpload = true;
+        else if (strcmp(argv[i], "-v") == 0) optVerbose = true;
+        else {
+            printf("Usage: povsim [options]\n");
+            printf("   -l <link>  Create symbolic link to the pty slave (e.g. /dev/ttyS6)\n");
+            printf("   -b <baud>  Pace both directions to <baud> 8n1 (default: no pacing)\n");
+            printf("   -B <baud>  Highest rate the 'B' command can switch to (default: any)\n");
+            printf("   -D <n>     Drop n of 1000 bytes on the link\n");
+            printf("   -X <n>     Corrupt n of 1000 bytes on the link\n");
+            printf("   -C <n>     Corrupt a byte in each of the first n '&' uploads (CRC error)\n");
+            printf("   -A         Take uploads right at the menu, without 'f' (see pccp -A)\n");
+            printf("   -r <Hz>    Telemetry frames per second (default 2)\n");
+            printf("   -p <us>    Rotation period (default 57143)\n");
+            printf("   -j <us>    Rotation period jitter (default 200)\n");
+            printf("   -k <n>     Skipped columns reported in {s} (default 0)\n");
+            printf("   -K <Hz>    Skip columns above <Hz>, less for bigger pictures (default: never)\n");
+            printf("   -m <port>  Run motor server on localhost:<port>, {p} follows the flywheel\n");
+            printf("   -n <%%>     Motor supply noise (default 2 %%)\n");
+            printf("   -S <seed>  Seed of the supply noise (default 1)\n");
+            printf("   -M         Log motor duty and frequency every second\n");
+            printf("   -v         Log every received byte\n");
+            return 1;
+        }
+    }
+    if (optTelemetryRate <= 0) optTelemetryRate = 2;
+    if (optPeriod == 0) optPeriod = 57143;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        printf("Cannot create pty: %s\n", strerror(errno));
+        return 1;
+    }
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    if (link) {
+        unlink(link);
+        if (symlink(ptsname(master), link) != 0) {
+            printf("Cannot create link %s: %s\n", link, strerror(errno));
+            return 1;
+        }
+    }
+    srand(time(NULL));
+    printf("POV cylinder simulator on %s\n", ptsname(master));
+    fflush(stdout);
+
+    pthread_create(&thread, NULL, writerThread, NULL);
+    pthread_create(&thread, NULL, telemetryThread, NULL);
+    if (optMotorPort) {
+        pthread_create(&thread, NULL, physicsThread, NULL);
+        pthread_create(&thread, NULL, motorServerThread, NULL);
+    }
+
+    for (;;) {
+        int c = simGetByte(-1);
+        if (c >= 0) command(c);
+        fflush(stdout);
+    }
+    return 0;
+}
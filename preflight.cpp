@@ -0,0 +1,50 @@
+#include <stdio.h>
+
+#include "preflight.h"
+#include "gif.h"
+#include "stats.h"
+
+static Histogram histPreflight("GIF preflight check", "us");
+
+//-----------------------------------------------------------------------------
+  bool preflight_check(const char *fileName, const char *tag, const char *name)
+//-----------------------------------------------------------------------------
+{
+    GifInfo info;
+    size_t size;
+    double work, rotations;
+    long long t0 = now_us();
+    int result = gif_analyze_file(fileName, &info, &size);
+
+    histPreflight.record(now_us() - t0);
+    if (name == NULL) name = fileName;
+    if (result != GIF_OK) {
+        printf("\n%sPreflight: %s is not a valid GIF file - not uploaded\n", tag, name);
+        return false;
+    }
+
+    // a frame every rotation or faster means one decode per frame change
+    rotations = info.minDelay > 0 ? 100. / PREFLIGHT_FREQ / info.minDelay : 1.;
+    work = (double)info.maxFrameWork / info.width * (rotations > 1. ? rotations : 1.);
+    printf("\n%sPreflight: %s %dx%d, %d frames, %.2f s, %lu bytes, decode work %.0f per column (%.1f ms)\n",
+           tag, name, info.width, info.height, info.nFrames, info.duration / 100.,
+           (unsigned long)size, work, (now_us() - t0) / 1000.);
+
+    // limits of the known firmware: the device has the last word
+    if (size > PREFLIGHT_MAXFILESIZE)
+        printf("%sPreflight: warning - larger than the %d bytes file buffer\n", tag, PREFLIGHT_MAXFILESIZE);
+    if (info.width > PREFLIGHT_MAXWIDTH || info.height > PREFLIGHT_MAXHEIGHT)
+        printf("%sPreflight: warning - larger than the %dx%d display\n",
+               tag, PREFLIGHT_MAXWIDTH, PREFLIGHT_MAXHEIGHT);
+    if (info.nFrames > PREFLIGHT_MAXFRAMES)
+        printf("%sPreflight: warning - more than %d frames\n", tag, PREFLIGHT_MAXFRAMES);
+    if (info.nFrames > 1 && info.minDelay >= 0 && info.minDelay < PREFLIGHT_MINDELAY)
+        printf("%sPreflight: warning - frames of %d ms, the cylinder shows them at least %d ms\n",
+               tag, info.minDelay * 10, PREFLIGHT_MINDELAY * 10);
+    if (info.outside)
+        printf("%sPreflight: warning - frames reach beyond the %dx%d screen\n", tag, info.width, info.height);
+    if (work > PREFLIGHT_MAXWORK)
+        printf("%sPreflight: warning - decode work %.0f per column is above %d, expect skipped columns\n",
+               tag, work, PREFLIGHT_MAXWORK);
+    return true;
+}
@@ -0,0 +1,38 @@
+#ifndef PREFLIGHT_H
+#define PREFLIGHT_H
+
+#include <stddef.h>
+
+// Preflight check of a GIF before it is uploaded to the cylinder.
+//
+// An upload takes up to a minute; a file the cylinder cannot show should be
+// found before that, not by a firmware error or skipped columns afterwards.
+// gif_analyze() walks all frames in a few milliseconds; the result is held
+// against the limits of the cylinder firmware:
+//   - rejected: no valid GIF (structure, truncated code streams, color
+//     indices) - no firmware can show it,
+//   - warning: file bigger than PREFLIGHT_MAXFILESIZE, logical screen
+//     larger than the display, more than PREFLIGHT_MAXFRAMES frames (the
+//     limits of the known firmware, a newer one may take more), frames
+//     shorter than PREFLIGHT_MINDELAY (they are shown longer), frames
+//     reaching beyond the logical screen, and an estimated decode work per
+//     column and rotation above PREFLIGHT_MAXWORK, where the display starts
+//     to skip columns.
+// The decode work of a frame is its LZW codes plus its pixels, spread over
+// the columns of the screen; frames changing faster than the cylinder turns
+// at PREFLIGHT_FREQ have to be decoded several times per rotation.
+
+#define PREFLIGHT_MAXFILESIZE   (50 * 1024)     // bytes, file buffer of the device
+#define PREFLIGHT_MAXWIDTH      320             // columns per rotation
+#define PREFLIGHT_MAXHEIGHT     240             // rows
+#define PREFLIGHT_MAXFRAMES     256
+#define PREFLIGHT_MINDELAY      5               // 1/100 s
+#define PREFLIGHT_FREQ          16.0            // Hz, default motor frequency
+#define PREFLIGHT_MAXWORK       1024            // codes + pixels per column and rotation
+
+// tag: in front of messages, e.g. "[left] "
+// name: file name in messages, NULL: fileName (e.g. for an optimized copy)
+// Return value: false if the file must not be uploaded
+bool preflight_check(const char *fileName, const char *tag = "", const char *name = NULL);
+
+#endif
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "recorder.h"
+
+//-----------------------------------------------------------------------------
+  Recorder::Recorder(void)
+//-----------------------------------------------------------------------------
+{
+    header = NULL;
+    samples = NULL;
+    mapSize = 0;
+}
+
+//-----------------------------------------------------------------------------
+  Recorder::~Recorder(void)
+//-----------------------------------------------------------------------------
+{
+    close();
+}
+
+//-----------------------------------------------------------------------------
+  bool Recorder::open(const char *fileName, uint32_t capacity, bool readOnly)
+//-----------------------------------------------------------------------------
+// capacity is only used when the file is created
+{
+    struct stat st;
+    RecorderHeader newHeader;
+    int fd;
+
+    close();
+    fd = ::open(fileName, readOnly ? O_RDONLY : O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        printf("Cannot open recorder file %s: %s\n", fileName, strerror(errno));
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+
+    if (st.st_size == 0 && !readOnly) {
+        // new file: write the header, size the ring
+        memset(&newHeader, 0, sizeof newHeader);
+        strcpy(newHeader.magic, RECORDER_MAGIC);
+        newHeader.recordSize = sizeof(RecorderSample);
+        newHeader.capacity = capacity;
+        if (write(fd, &newHeader, sizeof newHeader) != sizeof newHeader ||
+            ftruncate(fd, sizeof newHeader + (off_t)capacity * sizeof(RecorderSample)) != 0) {
+            printf("Cannot create recorder file %s: %s\n", fileName, strerror(errno));
+            ::close(fd);
+            return false;
+        }
+        st.st_size = sizeof newHeader + (off_t)capacity * sizeof(RecorderSample);
+    }
+
+    if ((size_t)st.st_size < sizeof(RecorderHeader) ||
+        pread(fd, &newHeader, sizeof newHeader, 0) != sizeof newHeader ||
+        memcmp(newHeader.magic, RECORDER_MAGIC, sizeof newHeader.magic) != 0 ||
+        newHeader.recordSize != sizeof(RecorderSample) || newHeader.capacity == 0 ||
+        (size_t)st.st_size < sizeof newHeader + (size_t)newHeader.capacity * sizeof(RecorderSample)) {
+        printf("%s is not a recorder file\n", fileName);
+        ::close(fd);
+        return false;
+    }
+
+    mapSize = sizeof newHeader + (size_t)newHeader.capacity * sizeof(RecorderSample);
+    void *p = mmap(NULL, mapSize, readOnly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);                // the mapping keeps the file
+    if (p == MAP_FAILED) {
+        printf("Cannot map recorder file %s: %s\n", fileName, strerror(errno));
+        return false;
+    }
+    header = (RecorderHeader *) p;
+    samples = (RecorderSample *) (header + 1);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+  void Recorder::close(void)
+//-----------------------------------------------------------------------------
+{
+    if (header) munmap(header, mapSize);
+    header = NULL;
+    samples = NULL;
+}
+
+//-----------------------------------------------------------------------------
+  void Recorder::record(char type, uint32_t value)
+//-----------------------------------------------------------------------------
+{
+    struct timespec ts;
+    RecorderSample *s;
+
+    if (header == NULL) return;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    s = &samples[header->head % header->capacity];
+    s->time_us = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    s->value = value;
+    s->type = type;
+    // publish the sample only after it is complete
+    __sync_synchronize();
+    header->head++;
+}
+
+//-----------------------------------------------------------------------------
+  uint64_t Recorder::getHead(void)
+//-----------------------------------------------------------------------------
+// number of samples recorded so far; pccp may add more while povrec reads
+{
+    if (header == NULL) return 0;
+    return *(volatile uint64_t *)&header->head;
+}
+
+//-----------------------------------------------------------------------------
+  uint64_t Recorder::getCount(void)
+//-----------------------------------------------------------------------------
+// number of samples that can be read; the oldest slot of a full ring is
+// the next one written, it does not count
+{
+    uint64_t head = getHead();
+
+    if (header == NULL) return 0;
+    return head < header->capacity ? head : header->capacity - 1;
+}
+
+//-----------------------------------------------------------------------------
+  bool Recorder::getSample(uint64_t n, RecorderSample *sample)
+//-----------------------------------------------------------------------------
+// n: number of the sample since the file was created, getHead() - getCount()
+// is the oldest one still in the ring.
+// The writer reuses the slot of sample n for sample n + capacity, which
+// it starts while head == n + capacity. The copy is only good if head is
+// still below that after it was taken.
+// Return value: false if sample n is gone or was overwritten while read
+{
+    if (header == NULL || n >= getHead() || n + header->capacity <= getHead()) return false;
+    *sample = samples[n % header->capacity];
+    __sync_synchronize();
+    return getHead() < n + header->capacity;
+}
@@ -0,0 +1,58 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Binary time-series recorder for the rotation telemetry.
+//
+// The file is a fixed-size ring of RecorderSample records behind a
+// RecorderHeader, mapped into memory with mmap(): recording one sample is
+// a memcpy without any system call, and disk use is bounded by the number
+// of records given when the file is created. An existing file is reopened
+// and continued. povrec exports the samples as CSV, also while pccp is
+// still recording: getSample() detects a sample overwritten while it was
+// read, the reader skips it.
+
+#define RECORDER_MAGIC           "POVREC1"
+#define RECORDER_DEFAULT_RECORDS (1024*1024)    // 16 MB, days of telemetry
+
+struct RecorderHeader           // 64 bytes
+{
+    char magic[8];              // RECORDER_MAGIC, NUL padded
+    uint32_t recordSize;        // sizeof(RecorderSample)
+    uint32_t capacity;          // number of records in the ring
+    uint64_t head;              // records written so far, next at head % capacity
+    uint8_t reserved[40];
+};
+
+struct RecorderSample           // 16 bytes
+{
+    int64_t time_us;            // CLOCK_REALTIME in microseconds
+    uint32_t value;
+    char type;                  // frame header: 'p', 's', 'c'
+    uint8_t reserved[3];
+};
+
+//-----------------------------------------------------------------------------
+  class Recorder
+//-----------------------------------------------------------------------------
+{
+  private:
+    RecorderHeader *header;     // start of the mapping, NULL if not open
+    RecorderSample *samples;
+    size_t mapSize;
+
+  public:
+     Recorder(void);
+    ~Recorder(void);
+     bool open(const char *fileName, uint32_t capacity = RECORDER_DEFAULT_RECORDS, bool readOnly = false);
+     void close(void);
+     bool isOpen(void) { return header != NULL; };
+     void record(char type, uint32_t value);
+     uint64_t getHead(void);
+     uint64_t getCount(void);
+     bool getSample(uint64_t n, RecorderSample *sample);
+};
+
+#endif
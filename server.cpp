@@ -0,0 +1,410 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+
+
+//-----------------------------------------------------------------------------
+  ApiServer::ApiServer(void)
+//-----------------------------------------------------------------------------
+{
+    int i;
+
+    listenFd = -1;
+    path[0] = 0;
+    nextId = 1;
+    reqHead = reqTail = 0;
+    for (i = 0; i < SERVER_MAXCLIENTS; i++) clients[i].fd = -1;
+}
+
+
+//-----------------------------------------------------------------------------
+  ApiServer::~ApiServer(void)
+//-----------------------------------------------------------------------------
+{
+    int i;
+
+    for (i = 0; i < SERVER_MAXCLIENTS; i++)
+        if (clients[i].fd >= 0) closeClient(clients[i]);
+    if (listenFd >= 0) {
+        close(listenFd);
+        unlink(path);
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+  bool ApiServer::open(const char *socketPath)
+//-----------------------------------------------------------------------------
+// A stale socket file of an earlier run is replaced.
+{
+    struct sockaddr_un addr;
+
+    if (strlen(socketPath) >= sizeof addr.sun_path) {
+        printf("Socket path %s is too long\n", socketPath);
+        return false;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketPath);
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        printf("socket failed with error: %s\n", strerror(errno));
+        return false;
+    }
+    unlink(socketPath);
+    if (bind(listenFd, (struct sockaddr *)&addr, sizeof addr) != 0 ||
+        listen(listenFd, SERVER_MAXCLIENTS) != 0) {
+        printf("Cannot listen on %s: %s\n", socketPath, strerror(errno));
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    fcntl(listenFd, F_SETFL, O_NONBLOCK);
+    strcpy(path, socketPath);
+    printf("API socket %s\n", path);
+    return true;
+}
+
+
+//-----------------------------------------------------------------------------
+  int ApiServer::getPollFds(struct pollfd *fds)
+//-----------------------------------------------------------------------------
+// the listening socket and all clients, SERVER_MAXCLIENTS+1 entries
+// Return value: number of entries filled in
+{
+    int i;
+
+    fds[0].fd = listenFd;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    for (i = 0; i < SERVER_MAXCLIENTS; i++) {
+        Client& c = clients[i];
+        // a full request queue or unread answers stop reading: the clients
+        // wait in write()
+        fds[i+1].events = reqHead - reqTail < SERVER_MAXREQUESTS && c.outLen < SERVER_OUTSIZE / 2 ? POLLIN : 0;
+        // answers the socket did not take go out when it has room
+        if (c.fd >= 0 && (c.reserved ? c.outReserved : c.outLen) > 0) fds[i+1].events |= POLLOUT;
+        fds[i+1].fd = fds[i+1].events ? c.fd : -1;
+        fds[i+1].revents = 0;
+    }
+    return SERVER_MAXCLIENTS + 1;
+}
+
+
+//-----------------------------------------------------------------------------
+  void ApiServer::handle(const struct pollfd *fds, int n)
+//-----------------------------------------------------------------------------
+// fds, n: as filled in by getPollFds() and returned by poll()
+{
+    int i;
+
+    if (fds[0].revents & POLLIN) acceptClient();
+    for (i = 1; i < n; i++) {
+        Client& c = clients[i-1];
+        if (fds[i].fd < 0) continue;
+        // a hangup while only answers are waiting shows up as a send error
+        if (fds[i].revents & (POLLOUT | POLLHUP | POLLERR)) flush(c);
+        if (c.fd >= 0 && (fds[i].events & POLLIN) && (fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            readClient(c);
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+  void ApiServer::acceptClient(void)
+//-----------------------------------------------------------------------------
+{
+    int fd, i;
+
+    fd = accept(listenFd, NULL, NULL);
+    if (fd < 0) return;
+    for (i = 0; i < SERVER_MAXCLIENTS && clients[i].fd >= 0; i++);
+    if (i == SERVER_MAXCLIENTS) {
+        static const char busy[] = "error too many clients\n";
+        if (::write(fd, busy, sizeof busy - 1) < 0) {}
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    clients[i].fd = fd;
+    clients[i].id = nextId++;
+    clients[i].subscribed = false;
+    clients[i].lineLen = 0;
+    clients[i].dropped = 0;
+    clients[i].outLen = 0;
+    clients[i].reserved = false;
+}
+
+
+//-----------------------------------------------------------------------------
+  void ApiServer::closeClient(Client& c)
+//-----------------------------------------------------------------------------
+{
+    close(c.fd);
+    c.fd = -1;
+}
+
+
+//-----------------------------------------------------------------------------
+  void ApiServer::readClient(Client& c)
+//-----------------------------------------------------------------------------
+// split what arrived into request lines
+{
+    char data[4096];
+    int n, i;
+
+    n = read(c.fd, data, sizeof data);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        closeClient(c);
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        if (data[i] == '\r') continue;
+        if (data[i] != '\n') {
+            if (c.lineLen < SERVER_LINESIZE - 1) c.line[c.lineLen++] = data[i];
+            continue;
+        }
+        c.line[c.lineLen] = 0;
+        c.lineLen = 0;
+        if (c.line[0] == 0) continue;
+        if (reqHead - reqTail >= SERVER_MAXREQUESTS) {
+            // the error is answered in the line's place: lines of the same
+            // client in a row share one entry, a read adds one at most
+            Request& last = requests[(reqHead - 1) % SERVER_QUEUESIZE];
+            if (last.rejected && last.client == c.id) last.rejected++;
+            else {
+                Request& r = requests[reqHead++ % SERVER_QUEUESIZE];
+                r.client = c.id;
+                r.rejected = 1;
+                r.line[0] = 0;
+            }
+            continue;
+        }
+        Request& r = requests[reqHead++ % SERVER_QUEUESIZE];
+        r.client = c.id;
+        r.rejected = 0;
+        strcpy(r.line, c.line);
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+  bool ApiServer::nextRequest(unsigned int *client, char *line,
+                              bool (*overtakes)(const char *line), unsigned int waiting)
+//-----------------------------------------------------------------------------
+// Takes the oldest request. With overtakes, while the oldest one has to
+// wait, it takes the oldest request overtakes() accepts whose client has
+// nothing older queued; waiting: client of a request taken earlier that
+// still waits, 0: none. Rejected lines are answered on the way.
+// line: SERVER_LINESIZE bytes
+// Return value: false if no request is taken
+{
+    unsigned int blocked[SERVER_QUEUESIZE + 1];
+    unsigned int nBlocked = 0;
+    unsigned int k, m, j;
+    bool take;
+
+    if (waiting) blocked[nBlocked++] = waiting;
+    for (k = reqTail; k != reqHead; k++) {
+        Request& r = requests[k % SERVER_QUEUESIZE];
+        for (j = 0; j < nBlocked && blocked[j] != r.client; j++);
+        if (j < nBlocked) continue;         // behind an older request of its client
+        take = !r.rejected && (overtakes == NULL || overtakes(r.line));
+        if (!r.rejected && !take) {
+            blocked[nBlocked++] = r.client;
+            continue;
+        }
+        for (j = 0; j < r.rejected; j++) reply(r.client, "error too many queued requests");
+        if (take) {
+            *client = r.client;
+            strcpy(line, r.line);
+        }
+        // close the gap
+        for (m = k; m != reqTail; m--)
+            requests[m % SERVER_QUEUESIZE] = requests[(m - 1) % SERVER_QUEUESIZE];
+        reqTail++;
+        if (take) return true;
+    }
+    return false;
+}
+
+
+//-----------------------------------------------------------------------------
+  ApiServer::Client *ApiServer::findClient(unsigned int id)
+//-----------------------------------------------------------------------------
+{
+    int i;
+
+    for (i = 0; i < SERVER_MAXCLIENTS; i++)
+        if (clients[i].fd >= 0 && clients[i].id == id) return &clients[i];
+    return NULL;
+}
+
+
+//-----------------------------------------------------------------------------
+  void ApiServer::flush(Client& c)
+//-----------------------------------------------------------------------------
+// as much of the answers as the socket takes, up to a reserved place
+{
+    unsigned int end = c.reserved ? c.outReserved : c.outLen;
+    int n;
+
+    if (end == 0) return;
+    n = send(c.fd, c.out, end, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) closeClient(c);
+        return;
+    }
+    memmove(c.out, c.out + n, c.outLen - n);
+    c.outLen -= n;
+    if (c.reserved) c.outReserved -= n;
+}
+
+
+//-----------------------------------------------------------------------------
+  void ApiServer::insert(Client& c, unsigned int at, const char *text, unsigned int length)
+//-----------------------------------------------------------------------------
+// put text into the unsent output at offset at
+{
+    if (c.outLen + length > SERVER_OUTSIZE) {
+        closeClient(c);         // it does not read its answers
+        return;
+    }
+    memmove(c.out + at + length, c.out + at, c.outLen - at);
+    memcpy(c.out + at, text, length);
+    c.outLen += length;
+    if (c.reserved && at < c.outReserved) c.outReserved += length;
+}
+
+
+//-----------------------------------------------------------------------------
+  bool ApiServer::write(Client& c, const char *text, unsigned int length)
+//-----------------------------------------------------------------------------
+// event line: never waits; a line the socket cannot take is dropped, as is
+// one that would have to wait behind answers
+// Return value: false if the line was dropped
+{
+    int n;
+
+    if ((c.reserved ? c.outReserved : c.outLen) > 0) return false;
+    n = send(c.fd, text, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n == (int)length) return true;
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) closeClient(c);
+        return false;
+    }
+    // a partial line would garble the stream: the rest goes out first
+    insert(c, 0, text + n, length - n);
+    if (c.reserved) c.outReserved += length - n;
+    return true;
+}
+
+
+//-----------------------------------------------------------------------------
+  void ApiServer::reply(unsigned int client, const char *format, ...)
+//-----------------------------------------------------------------------------
+// answer line, sent after all earlier ones
+{
+    char text[SERVER_LINESIZE];
+    Client *c = findClient(client);
+    va_list args;
+    int n;
+
+    if (c == NULL) return;
+    va_start(args, format);
+    n = vsnprintf(text, sizeof text - 1, format, args);
+    va_end(args);
+    if (n > (int)sizeof text - 2) n = sizeof text - 2;
+    text[n++] = '\n';
+    insert(*c, c->outLen, text, n);
+    if (c->fd >= 0) flush(*c);
+}
+
+
+//-----------------------------------------------------------------------------
+  void ApiServer::reserve(unsigned int client)
+//-----------------------------------------------------------------------------
+// keep the place of the answer the running request gives later, answers
+// to later requests wait behind it; one place per client
+{
+    Client *c = findClient(client);
+
+    if (c == NULL) return;
+    c->reserved = true;
+    c->outReserved = c->outLen;
+}
+
+
+//-----------------------------------------------------------------------------
+  void ApiServer::replyReserved(unsigned int client, const char *format, ...)
+//-----------------------------------------------------------------------------
+// the answer for the place reserve() kept
+{
+    char text[SERVER_LINESIZE];
+    Client *c = findClient(client);
+    va_list args;
+    int n;
+
+    if (c == NULL) return;
+    va_start(args, format);
+    n = vsnprintf(text, sizeof text - 1, format, args);
+    va_end(args);
+    if (n > (int)sizeof text - 2) n = sizeof text - 2;
+    text[n++] = '\n';
+    insert(*c, c->reserved ? c->outReserved : c->outLen, text, n);
+    c->reserved = false;
+    if (c->fd >= 0) flush(*c);
+}
+
+
+//-----------------------------------------------------------------------------
+  void ApiServer::subscribe(unsigned int client)
+//-----------------------------------------------------------------------------
+{
+    Client *c = findClient(client);
+    if (c) c->subscribed = true;
+}
+
+
+//-----------------------------------------------------------------------------
+  void ApiServer::publish(const char *format, ...)
+//-----------------------------------------------------------------------------
+// event line to all subscribed clients
+{
+    char text[SERVER_LINESIZE];
+    va_list args;
+    int i, n;
+
+    for (i = 0; i < SERVER_MAXCLIENTS && !(clients[i].fd >= 0 && clients[i].subscribed); i++);
+    if (i == SERVER_MAXCLIENTS) return;     // nobody listens: don't format
+
+    va_start(args, format);
+    n = vsnprintf(text, sizeof text - 1, format, args);
+    va_end(args);
+    if (n > (int)sizeof text - 2) n = sizeof text - 2;
+    text[n++] = '\n';
+    for (; i < SERVER_MAXCLIENTS; i++) {
+        Client& c = clients[i];
+        if (c.fd < 0 || !c.subscribed) continue;
+        if (c.dropped) {
+            char note[32];
+            int len = sprintf(note, "dropped %lu\n", c.dropped);
+            if (!write(c, note, len)) {
+                c.dropped++;
+                continue;
+            }
+            c.dropped = 0;
+        }
+        if (!write(c, text, n)) c.dropped++;
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+
+// Local control API on a Unix domain socket (-S <path>).
+//
+// Requests are text lines; every request gets exactly one answer line
+// "ok ..." or "error ...", in request order. Clients may send many
+// requests in one write (batch); they are queued and executed one after
+// the other. A request that finds the queue full is answered with an
+// error in its place. Answers wait in a buffer per client until the
+// socket takes them; reserve() keeps the place of an answer that comes
+// later, answers behind it wait for it. Requests of a client whose answers
+// pile up are not read until it takes them; one that leaves
+// SERVER_OUTSIZE bytes unread anyway is closed.
+// A subscribed client additionally receives event lines (telemetry) as
+// they happen. A client that does not read its events loses them instead
+// of stalling pccp; the next event it gets is preceded by "dropped <n>".
+
+#define SERVER_MAXCLIENTS   8
+#define SERVER_LINESIZE     512
+#define SERVER_MAXREQUESTS  64      // queued requests of all clients
+#define SERVER_QUEUESIZE    128     // power of 2, room for the rejects behind a full queue
+#define SERVER_OUTSIZE      16384   // unsent answers per client
+
+struct pollfd;
+
+//-----------------------------------------------------------------------------
+  class ApiServer
+//-----------------------------------------------------------------------------
+{
+  private:
+    struct Client {
+        int fd;                     // -1: free slot
+        unsigned int id;            // never reused, replies to a closed client are dropped
+        bool subscribed;
+        char line[SERVER_LINESIZE];
+        unsigned int lineLen;
+        unsigned long dropped;      // events lost because the client did not read
+        char out[SERVER_OUTSIZE];   // answers the socket has not taken yet
+        unsigned int outLen;
+        bool reserved;              // an answer still to come goes to outReserved
+        unsigned int outReserved;   // nothing from there on is sent before it
+    };
+    struct Request {
+        unsigned int client;
+        unsigned int rejected;      // >0: that many lines found the queue full
+        char line[SERVER_LINESIZE];
+    };
+
+    int listenFd;
+    char path[108];
+    Client clients[SERVER_MAXCLIENTS];
+    unsigned int nextId;
+    Request requests[SERVER_QUEUESIZE];
+    unsigned int reqHead, reqTail;  // free running ring indices
+
+    void acceptClient(void);
+    void readClient(Client& c);
+    void closeClient(Client& c);
+    Client *findClient(unsigned int id);
+    void flush(Client& c);
+    void insert(Client& c, unsigned int at, const char *text, unsigned int length);
+    bool write(Client& c, const char *text, unsigned int length);
+
+  public:
+     ApiServer(void);
+    ~ApiServer(void);
+     bool open(const char *socketPath);
+     bool isOpen(void) { return listenFd >= 0; };
+     int getPollFds(struct pollfd *fds);
+     void handle(const struct pollfd *fds, int n);
+     bool nextRequest(unsigned int *client, char *line,
+                      bool (*overtakes)(const char *line) = NULL, unsigned int waiting = 0);
+     void reply(unsigned int client, const char *format, ...);
+     void reserve(unsigned int client);
+     void replyReserved(unsigned int client, const char *format, ...);
+     void subscribe(unsigned int client);
+     void publish(const char *format, ...);
+};
+
+#endif
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+Histogram *Histogram::first = NULL;
+
+//-----------------------------------------------------------------------------
+  long long now_us(void)
+//-----------------------------------------------------------------------------
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//-----------------------------------------------------------------------------
+  long long now_ms(void)
+//-----------------------------------------------------------------------------
+{
+    return now_us() / 1000;
+}
+
+//-----------------------------------------------------------------------------
+  Histogram::Histogram(const char *histName, const char *histUnit)
+//-----------------------------------------------------------------------------
+{
+    name = histName;
+    unit = histUnit;
+    reset();
+    // append: printAll() lists the histograms in the order of definition
+    Histogram **p = &first;
+    while (*p) p = &(*p)->next;
+    next = NULL;
+    *p = this;
+}
+
+//-----------------------------------------------------------------------------
+  void Histogram::reset(void)
+//-----------------------------------------------------------------------------
+{
+    memset(counts, 0, sizeof counts);
+    count = 0;
+    min = max = 0;
+    sum = 0.;
+}
+
+//-----------------------------------------------------------------------------
+  unsigned int Histogram::bucketOf(uint64_t value)
+//-----------------------------------------------------------------------------
+// values < HIST_SUBBUCKETS map to themselves, above that each power of two
+// is split into HIST_SUBBUCKETS/2 buckets
+{
+    const unsigned int half = HIST_SUBBUCKETS / 2;
+    unsigned int shift;
+
+    if (value < HIST_SUBBUCKETS) return value;
+    shift = 63 - __builtin_clzll(value) - __builtin_ctz(half);
+    return shift * half + (value >> shift);
+}
+
+//-----------------------------------------------------------------------------
+  uint64_t Histogram::bucketValue(unsigned int bucket)
+//-----------------------------------------------------------------------------
+// Return value: highest value that falls into the bucket
+{
+    const unsigned int half = HIST_SUBBUCKETS / 2;
+    unsigned int shift;
+
+    if (bucket < HIST_SUBBUCKETS) return bucket;
+    shift = bucket / half - 1;
+    return (((uint64_t)(bucket - shift * half) + 1) << shift) - 1;
+}
+
+//-----------------------------------------------------------------------------
+  void Histogram::record(long long value)
+//-----------------------------------------------------------------------------
+{
+    uint64_t v = value < 0 ? 0 : value;
+
+    counts[bucketOf(v)]++;
+    if (count == 0 || v < min) min = v;
+    if (v > max) max = v;
+    sum += v;
+    count++;
+}
+
+//-----------------------------------------------------------------------------
+  uint64_t Histogram::getPercentile(double percent)
+//-----------------------------------------------------------------------------
+{
+    uint64_t rank, seen = 0;
+    unsigned int i;
+
+    if (count == 0) return 0;
+    rank = (uint64_t)(percent / 100. * count + 0.5);
+    if (rank < 1) rank = 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank) break;
+    }
+    // the bucket limit may overshoot the largest value seen
+    return bucketValue(i) < max ? bucketValue(i) : max;
+}
+
+//-----------------------------------------------------------------------------
+  void Histogram::print(void)
+//-----------------------------------------------------------------------------
+{
+    printf("%-22s %8llu", name, (unsigned long long)count);
+    if (count)
+        printf(" %10llu %10llu %10llu %10llu %10llu %10llu %12.1f",
+               (unsigned long long)min,
+               (unsigned long long)getPercentile(50.),
+               (unsigned long long)getPercentile(90.),
+               (unsigned long long)getPercentile(99.),
+               (unsigned long long)getPercentile(99.9),
+               (unsigned long long)max, sum / count);
+    printf("  %s\n", unit);
+}
+
+//-----------------------------------------------------------------------------
+  void Histogram::printAll(void)
+//-----------------------------------------------------------------------------
+{
+    Histogram *h;
+
+    printf("\n%-22s %8s %10s %10s %10s %10s %10s %10s %12s\n",
+           "", "count", "min", "p50", "p90", "p99", "p99.9", "max", "mean");
+    for (h = first; h; h = h->next)
+        h->print();
+}
+
+//-----------------------------------------------------------------------------
+  Throughput::Throughput(const char *name) : Histogram(name, "bytes/s")
+//-----------------------------------------------------------------------------
+{
+    windowStart = 0;
+    windowBytes = 0;
+}
+
+//-----------------------------------------------------------------------------
+  void Throughput::add(unsigned long bytes)
+//-----------------------------------------------------------------------------
+{
+    long long t;
+
+    if (bytes == 0) return;
+    t = now_us();
+    if (windowStart && t - windowStart >= 1000000) {
+        record(windowBytes);
+        windowStart = 0;
+    }
+    if (windowStart == 0) {
+        windowStart = t;
+        windowBytes = 0;
+    }
+    windowBytes += bytes;
+}
+
+//-----------------------------------------------------------------------------
+  void Throughput::print(void)
+//-----------------------------------------------------------------------------
+{
+    // close a window that ended since the last byte
+    if (windowStart && now_us() - windowStart >= 1000000) {
+        record(windowBytes);
+        windowStart = 0;
+    }
+    Histogram::print();
+}
+
+#ifdef STATS_SELFTEST
+// Self test of the bucket mapping and percentiles, see stats.sh.
+#include <stdlib.h>
+
+//-----------------------------------------------------------------------------
+  int main(void)
+//-----------------------------------------------------------------------------
+{
+    Histogram h("uniform 1..1000000", "us");
+    long long i, t0;
+    int errors = 0;
+
+    t0 = now_us();
+    for (i = 1; i <= 1000000; i++)
+        h.record(i);
+    printf("record: %.1f ns per value\n", (now_us() - t0) * 1000. / 1000000);
+
+    // percentiles must be within the 1/HIST_SUBBUCKETS*2 bucket width
+    const double percent[] = { 50., 90., 99., 99.9 };
+    for (i = 0; i < 4; i++) {
+        double expected = percent[i] * 10000.;
+        double got = h.getPercentile(percent[i]);
+        if (got < expected || got > expected * (1. + 2. / HIST_SUBBUCKETS)) {
+            printf("p%g: %.0f, expected %.0f\n", percent[i], got, expected);
+            errors++;
+        }
+    }
+    for (i = 0; i < 100000; i++) {
+        uint64_t v = ((uint64_t)rand() << 31 | rand()) >> (rand() % 62);
+        h.reset();
+        h.record(v);
+        if (h.getPercentile(50.) != v) {
+            printf("single value %llu read back as %llu\n",
+                   (unsigned long long)v, (unsigned long long)h.getPercentile(50.));
+            errors++;
+            break;
+        }
+    }
+    h.reset();
+    h.record(5);
+    h.record(1000000);
+    h.record(1LL << 62);
+    Histogram::printAll();
+    printf("%s\n", errors ? "FAILED" : "OK");
+    return errors != 0;
+}
+#endif
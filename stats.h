@@ -0,0 +1,67 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+// Instrumentation: a monotonic clock shared by all modules, histograms
+// for latencies and rates, and a throughput meter.
+//
+// Histogram buckets are log-linear like an HDR histogram: values below
+// HIST_SUBBUCKETS are counted exactly, larger ones in HIST_SUBBUCKETS/2
+// linear steps per power of two, i.e. with better than 3 % resolution over
+// the whole 64 bit range in a fixed 8 KB table. Recording is a few integer
+// operations, so it can stay enabled all the time. Every histogram links
+// itself into a list that Histogram::printAll() dumps (pccp: on exit and
+// on SIGUSR1).
+
+long long now_us(void);         // CLOCK_MONOTONIC
+long long now_ms(void);
+
+#define HIST_SUBBUCKETS 64      // must be a power of 2
+#define HIST_BUCKETS    2048    // enough for 64 bit values
+
+//-----------------------------------------------------------------------------
+  class Histogram
+//-----------------------------------------------------------------------------
+{
+  private:
+    const char *name;
+    const char *unit;
+    uint32_t counts[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t min, max;
+    double sum;
+    Histogram *next;            // list of all histograms
+    static Histogram *first;
+
+    static unsigned int bucketOf(uint64_t value);
+    static uint64_t bucketValue(unsigned int bucket);
+
+  public:
+     Histogram(const char *name, const char *unit);
+     void record(long long value);
+     void reset(void);
+     uint64_t getCount(void) { return count; };
+     uint64_t getPercentile(double percent);
+     virtual void print(void);
+     static void printAll(void);
+};
+
+//-----------------------------------------------------------------------------
+  class Throughput : public Histogram
+//-----------------------------------------------------------------------------
+// Bytes per second in windows of one second: the first byte starts a
+// window, the bytes until its end are recorded as one sample. Idle time
+// does not show up as low rates.
+{
+  private:
+    long long windowStart;      // us, 0: no window open
+    unsigned long windowBytes;
+
+  public:
+     Throughput(const char *name);
+     void add(unsigned long bytes);
+     void print(void);
+};
+
+#endif
@@ -0,0 +1 @@
+g++ -O2 -Wall -DSTATS_SELFTEST -o stats.exe stats.cpp
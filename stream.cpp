@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "stream.h"
+#include "gif.h"
+#include "stats.h"
+
+#define STREAM_MAXSKIP  1000        // sequence files skipped in one go
+
+//-----------------------------------------------------------------------------
+  FrameStream::FrameStream(void)
+//-----------------------------------------------------------------------------
+{
+    source[0] = 0;
+    sequence = false;
+    nextIndex = 0;
+    fd = -1;
+    fifo = false;
+    buffer = frame = sending = NULL;
+    bufferLength = frameSize = 0;
+    frameReady = false;
+    frameName[0] = 0;
+    active = false;
+    ended = false;
+    period = STREAM_DEFAULT_PERIOD;
+    rotationsPerFrame = 1;
+    lastFrame = 0;
+    nFrames = nSent = nDropped = nThrottled = 0;
+}
+
+//-----------------------------------------------------------------------------
+  FrameStream::~FrameStream(void)
+//-----------------------------------------------------------------------------
+{
+    stop();
+}
+
+//-----------------------------------------------------------------------------
+  bool FrameStream::validPattern(const char *pattern)
+//-----------------------------------------------------------------------------
+// exactly one integer conversion, %[flags][width][.precision]d|i|u|x|X|o,
+// besides it only "%%"
+{
+    const char *p;
+    int n = 0;
+
+    for (p = pattern; (p = strchr(p, '%')) != NULL; p++) {
+        if (*++p == '%') continue;
+        p += strspn(p, "-+ #0");
+        p += strspn(p, "0123456789");
+        if (*p == '.') p += 1 + strspn(p + 1, "0123456789");
+        if (*p == 0 || strchr("diuxXo", *p) == NULL) return false;
+        n++;
+    }
+    return n == 1;
+}
+
+//-----------------------------------------------------------------------------
+  bool FrameStream::open(const char *sourceName)
+//-----------------------------------------------------------------------------
+{
+    stop();
+    strncpy(source, sourceName, sizeof source - 1);
+    source[sizeof source - 1] = 0;
+    sequence = strchr(source, '%') != NULL;
+    if (sequence && !validPattern(source)) {
+        printf("Stream %s: a file name pattern needs exactly one integer conversion (e.g. %%05d), "
+               "a literal %% is written %%%%\n", source);
+        return false;
+    }
+    nextIndex = 0;
+    rotationsPerFrame = 1;
+    lastFrame = 0;
+    nFrames = nSent = nDropped = nThrottled = 0;
+    if (!sequence && !openSource()) return false;
+    frame = (unsigned char *) malloc(STREAM_MAXFRAME);
+    sending = (unsigned char *) malloc(STREAM_MAXFRAME);
+    if (!sequence) buffer = (unsigned char *) malloc(STREAM_MAXFRAME);
+    if (frame == NULL || sending == NULL || (!sequence && buffer == NULL)) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    strcpy(frameName, source);
+    active = true;
+    ended = false;
+    printf("Streaming frames from %s\n", source);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+  bool FrameStream::openSource(void)
+//-----------------------------------------------------------------------------
+// a FIFO opened without waiting for a writer reports POLLIN once one writes
+{
+    struct stat st;
+
+    fd = ::open(source, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+        printf("Stream source %s not found\n", source);
+        return false;
+    }
+    fifo = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+  void FrameStream::stop(void)
+//-----------------------------------------------------------------------------
+{
+    if (fd >= 0) close(fd);
+    fd = -1;
+    free(buffer);
+    free(frame);
+    free(sending);
+    buffer = frame = sending = NULL;
+    bufferLength = 0;
+    frameReady = false;
+    active = false;
+}
+
+//-----------------------------------------------------------------------------
+  void FrameStream::frameComplete(const unsigned char *data, size_t size)
+//-----------------------------------------------------------------------------
+{
+    if (frameReady) nDropped++;     // never sent: the new one is more recent
+    memcpy(frame, data, size);
+    frameSize = size;
+    frameReady = true;
+    nFrames++;
+}
+
+//-----------------------------------------------------------------------------
+  void FrameStream::handleInput(void)
+//-----------------------------------------------------------------------------
+// read what the pipe has and cut it into frames
+{
+    ssize_t n;
+    long length;
+
+    if (fd < 0) return;
+    n = read(fd, buffer + bufferLength, STREAM_MAXFRAME - bufferLength);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (n <= 0) {
+        if (n < 0) printf("Stream %s: read failed: %s\n", source, strerror(errno));
+        close(fd);
+        fd = -1;
+        bufferLength = 0;           // an incomplete frame stays incomplete
+        if (fifo && n == 0) openSource();   // wait for the next writer
+        else {
+            // a file does not grow: the stream ends with the frame it has
+            printf("\nStream %s: end of input\n", source);
+            ended = true;
+            if (!frameReady) active = false;
+        }
+        return;
+    }
+    bufferLength += n;
+
+    while (bufferLength > 0) {
+        length = gif_length(buffer, bufferLength);
+        if (length > 0) {
+            frameComplete(buffer, length);
+            bufferLength -= length;
+            memmove(buffer, buffer + length, bufferLength);
+        }
+        else if (length == GIF_ERROR) {
+            // go to the next "GIF8", keep a tail that may be its beginning
+            unsigned char *p = (unsigned char *) memmem(buffer + 1, bufferLength - 1, "GIF8", 4);
+            size_t skip = p ? (size_t)(p - buffer) : bufferLength > 4 ? bufferLength - 3 : 1;
+            printf("\nStream %s: %lu bytes between frames skipped\n", source, (unsigned long)skip);
+            bufferLength -= skip;
+            memmove(buffer, buffer + skip, bufferLength);
+        }
+        else {
+            if (bufferLength == STREAM_MAXFRAME) {
+                // the rest of it is skipped as garbage
+                printf("\nStream %s: frame larger than %d bytes skipped\n", source, STREAM_MAXFRAME);
+                bufferLength = 0;
+            }
+            break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+  bool FrameStream::sequenceFrame(void)
+//-----------------------------------------------------------------------------
+// Newest file of the sequence into frame (its name into frameName), the
+// ones before it are dropped. A file is taken when it holds a complete GIF;
+// a broken one is only passed over when the producer has written the next
+// one.
+{
+    char name[sizeof frameName];
+    struct stat st;
+    bool complete;
+    FILE *fp;
+    int i;
+
+    for (i = 0; i < STREAM_MAXSKIP; i++) {
+        snprintf(name, sizeof name, source, nextIndex + 1);
+        if (stat(name, &st) != 0) break;
+        nextIndex++;
+        nDropped++;
+        nFrames++;
+    }
+    snprintf(name, sizeof name, source, nextIndex);
+    if (stat(name, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 || st.st_size > STREAM_MAXFRAME)
+        return false;
+    if ((fp = fopen(name, "rb")) == NULL) return false;
+    complete = fread(frame, 1, st.st_size, fp) == (size_t)st.st_size
+               && gif_length(frame, st.st_size) == st.st_size;
+    fclose(fp);
+    if (!complete) return false;
+    frameSize = st.st_size;
+    strcpy(frameName, name);
+    nextIndex++;
+    nFrames++;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+  void FrameStream::skippedColumns(unsigned int n)
+//-----------------------------------------------------------------------------
+// {s} report: back off quickly while the device skips, recover slowly
+{
+    if (!active) return;
+    if (n > 0) {
+        rotationsPerFrame = rotationsPerFrame * 2 > STREAM_MAXROTATIONS ? STREAM_MAXROTATIONS : rotationsPerFrame * 2;
+        nThrottled++;
+    }
+    else if (rotationsPerFrame > 1) rotationsPerFrame--;
+}
+
+//-----------------------------------------------------------------------------
+  int FrameStream::getTimeout(void)
+//-----------------------------------------------------------------------------
+// Return value: poll() timeout in ms until the next frame is due,
+// 0: due now, -1: no frame (the pipe wakes up poll())
+{
+    long long t;
+
+    if (!active || (!sequence && !frameReady)) return -1;
+    // a sequence is looked at once per frame time for a new file
+    t = lastFrame + (long long)rotationsPerFrame * period / 1000 - now_ms();
+    return t < 0 ? 0 : (int)t;
+}
+
+//-----------------------------------------------------------------------------
+  const char *FrameStream::takeFrame(const unsigned char **data, size_t *size)
+//-----------------------------------------------------------------------------
+// data, size: the GIF, it stays unchanged until the next takeFrame() or stop()
+// Return value: name of the frame for messages, NULL: none
+{
+    unsigned char *p;
+
+    if (!active) return NULL;
+    if (sequence) {
+        if (!sequenceFrame()) {
+            lastFrame = now_ms();   // look again one frame time later
+            return NULL;
+        }
+    }
+    else {
+        if (!frameReady) return NULL;
+        frameReady = false;
+        // the buffers stay until stop(): the last frame is still uploaded
+        if (ended) active = false;
+    }
+    // the pipe goes on filling frame while this one is uploaded
+    p = sending;
+    sending = frame;
+    frame = p;
+    *data = sending;
+    *size = frameSize;
+    lastFrame = now_ms();
+    nSent++;
+    return frameName;
+}
+
+//-----------------------------------------------------------------------------
+  void FrameStream::printStats(void)
+//-----------------------------------------------------------------------------
+{
+    if (source[0] == 0) return;
+    printf("Stream %s: %lu frames, %lu sent, %lu dropped, throttled %lu times, %u rotations per frame\n",
+           source, nFrames, nSent, nDropped, nThrottled, rotationsPerFrame);
+}
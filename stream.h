@@ -0,0 +1,75 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+// Live frame stream (-L <source>).
+//
+// Every frame is a complete GIF. The source is either
+//   - a pipe (FIFO) or file delivering GIFs back to back; when the writer
+//     of a FIFO goes away, the next one is waited for, the end of a file
+//     ends the stream once its last frame is sent, or
+//   - a printf pattern of numbered files, e.g. frames/%05d.gif, that a
+//     producer writes one after the other starting at 0 (write to a temporary
+//     name and rename, a file is only taken when it is a complete GIF). The
+//     pattern must hold exactly one integer conversion; a literal '%' is
+//     written "%%".
+// A frame is read once and uploaded from memory.
+// Only the newest frame is kept: a frame that is superseded before it could
+// be sent is dropped, so a producer faster than the link never builds up a
+// backlog and the cylinder always shows the most recent picture.
+//
+// Pacing: a frame is sent at most once per rotation (period from {p}). When
+// the device reports skipped columns ({s}) the number of rotations per frame
+// is doubled, every report without skips lowers it by one again. Apart from
+// that the link is the limit: the next frame waits until the previous one
+// is through.
+
+#define STREAM_MAXFRAME         (1 << 20)   // largest GIF taken from a pipe
+#define STREAM_MAXROTATIONS     64          // rotations per frame when throttled
+#define STREAM_DEFAULT_PERIOD   50000       // us, until the first {p}
+
+//-----------------------------------------------------------------------------
+  class FrameStream
+//-----------------------------------------------------------------------------
+{
+  private:
+    char source[256];
+    bool sequence;                  // source is a file name pattern
+    int nextIndex;                  // sequence: number of the next file
+    int fd;                         // pipe or file, -1: none (open)
+    bool fifo;
+    unsigned char *buffer;          // pipe: data of incomplete frames
+    size_t bufferLength;
+    bool resync;                    // pipe: skipping garbage up to the next GIF
+    unsigned char *frame;           // newest complete frame
+    size_t frameSize;
+    bool frameReady;                // pipe: a frame is waiting to be sent
+    unsigned char *sending;         // frame handed out by takeFrame()
+    char frameName[256];            // sequence: file of the frame, pipe: source
+    bool active;
+    bool ended;                     // pipe: input over, inactive after the last frame
+    unsigned int period;            // us
+    unsigned int rotationsPerFrame;
+    long long lastFrame;            // ms, time the last frame was taken
+    unsigned long nFrames, nSent, nDropped, nThrottled;
+
+    static bool validPattern(const char *pattern);
+    bool openSource(void);
+    bool sequenceFrame(void);
+    void frameComplete(const unsigned char *data, size_t size);
+
+  public:
+     FrameStream(void);
+    ~FrameStream(void);
+     bool open(const char *sourceName);
+     void stop(void);
+     bool isActive(void) { return active; };
+     int getHandle(void) { return active ? fd : -1; };
+     void handleInput(void);
+     void setPeriod(unsigned int us) { if (us) period = us; };
+     void skippedColumns(unsigned int n);
+     int getTimeout(void);
+     const char *takeFrame(const unsigned char **data, size_t *size);
+     void printStats(void);
+};
+
+#endif
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "telemetry.h"
+
+//-----------------------------------------------------------------------------
+  TelemetryParser::TelemetryParser(TelemetryHandler handler, void *context)
+//-----------------------------------------------------------------------------
+{
+    state = S_TEXT;
+    frameLen = 0;
+    badFrames = 0;
+    setHandler(handler, context);
+}
+
+//-----------------------------------------------------------------------------
+  void TelemetryParser::setHandler(TelemetryHandler newHandler, void *newContext)
+//-----------------------------------------------------------------------------
+{
+    handler = newHandler;
+    context = newContext;
+}
+
+//-----------------------------------------------------------------------------
+  void TelemetryParser::emitText(const char *text, unsigned int length)
+//-----------------------------------------------------------------------------
+{
+    TelemetryEvent ev;
+    ev.type = 0;
+    ev.text = text;
+    ev.length = length;
+    ev.value = 0;
+    ev.numeric = false;
+    handler(context, ev);
+}
+
+//-----------------------------------------------------------------------------
+  void TelemetryParser::abortFrame(void)
+//-----------------------------------------------------------------------------
+// not a frame after all: what was collected is console text
+{
+    badFrames++;
+    state = S_TEXT;
+    emitText(frame, frameLen);
+}
+
+//-----------------------------------------------------------------------------
+  void TelemetryParser::feed(const char *data, size_t length)
+//-----------------------------------------------------------------------------
+{
+    const char *end = data + length;
+
+    while (data < end) {
+        if (state == S_TEXT) {
+            // pass the console text up to the next '{' in one piece
+            const char *brace = (const char *) memchr(data, '{', end - data);
+            if (brace == NULL) {
+                emitText(data, end - data);
+                return;
+            }
+            if (brace > data) emitText(data, brace - data);
+            data = brace + 1;
+            frame[0] = '{';
+            frameLen = 1;
+            state = S_HEADER;
+            continue;
+        }
+
+        char ch = *data;
+        if (state == S_HEADER) {
+            if (!((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z'))) {
+                abortFrame();       // ch is parsed again as text
+                continue;
+            }
+            frame[frameLen++] = ch;
+            value = 0;
+            numeric = true;
+            state = S_PAYLOAD;
+            data++;
+            continue;
+        }
+
+        // S_PAYLOAD
+        if (ch == '}') {
+            TelemetryEvent ev;
+            ev.type = frame[1];
+            ev.text = frame + 2;
+            ev.length = frameLen - 2;
+            ev.value = value;
+            ev.numeric = numeric && frameLen > 2;
+            state = S_TEXT;
+            data++;
+            handler(context, ev);
+            continue;
+        }
+        if (ch < ' ' || ch > '~' || ch == '{' || frameLen == sizeof frame) {
+            abortFrame();           // ch is parsed again as text
+            continue;
+        }
+        frame[frameLen++] = ch;
+        if (ch >= '0' && ch <= '9' && value <= (ULONG_MAX - 9) / 10) value = value * 10 + ch - '0';
+        else numeric = false;
+        data++;
+    }
+}
+
+
+#ifdef TELEMETRY_SELFTEST
+// Self test and throughput benchmark, see telemetry.sh.
+#include <time.h>
+
+static char output[1 << 20];
+static size_t outputLen;
+static unsigned long frames, sum;
+
+static void collect(void *, const TelemetryEvent& ev)
+{
+    if (ev.type == 0) {
+        memcpy(output + outputLen, ev.text, ev.length);
+        outputLen += ev.length;
+    }
+    else {
+        outputLen += sprintf(output + outputLen, "<%c%lu%s>", ev.type, ev.value, ev.numeric ? "" : "?");
+    }
+}
+
+static void count(void *, const TelemetryEvent& ev)
+{
+    if (ev.type) {
+        frames++;
+        sum += ev.value;
+    }
+}
+
+static int check(const char *input, const char *expected)
+{
+    TelemetryParser parser(collect, NULL);
+    size_t i, len = strlen(input);
+    int errors = 0;
+
+    // whole and byte by byte must give the same result
+    for (int pass = 0; pass < 2; pass++) {
+        outputLen = 0;
+        parser.reset();
+        if (pass == 0) parser.feed(input, len);
+        else for (i = 0; i < len; i++) parser.feed(input + i, 1);
+        output[outputLen] = 0;
+        if (strcmp(output, expected) != 0) {
+            printf("FAIL: '%s' -> '%s', expected '%s'\n", input, output, expected);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+static double seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void)
+{
+    int errors = 0;
+
+    errors += check("hello {p57143}{s0}{c1234} world", "hello <p57143><s0><c1234> world");
+    errors += check("{p123", "");                               // incomplete: waits
+    errors += check("a{p12\nb", "a{p12\nb");                    // newline breaks the frame
+    errors += check("x{{p5}y", "x{<p5>y");                       // stray '{'
+    errors += check("{ pretty }", "{ pretty }");                 // no header letter
+    errors += check("{p12345678901234567}z", "{p12345678901234567}z");  // too long
+    errors += check("{xhello}", "<x0?>");                        // new frame type
+    errors += check("{r}{a12}", "<r0?><a12>");
+    printf("telemetry: %d errors\n", errors);
+
+    // throughput: menu text with telemetry every few lines
+    {
+        const size_t SIZE = 1 << 20;
+        const int RUNS = 200;
+        static char data[SIZE];
+        TelemetryParser parser(count, NULL);
+        size_t n = 0;
+        double t0, t1;
+        int r;
+
+        while (n < SIZE - 64) {
+            n += sprintf(data + n, n % 3 ? "y - playback internal GIF picture\n" : "{p%u}{s%u}{c%u}",
+                         57000 + (unsigned)(n % 300), (unsigned)(n % 3), (unsigned)n);
+        }
+        t0 = seconds();
+        for (r = 0; r < RUNS; r++) {
+            parser.feed(data, n);
+        }
+        t1 = seconds();
+        printf("mixed text:   %8.1f MB/s (%lu frames)\n", RUNS * n / (t1-t0) / 1e6, frames);
+
+        frames = 0;
+        t0 = seconds();
+        for (r = 0; r < RUNS / 10; r++) {
+            for (size_t i = 0; i < n; i += 7) parser.feed(data + i, n - i < 7 ? n - i : 7);
+        }
+        t1 = seconds();
+        printf("7 byte reads: %8.1f MB/s (%lu frames)\n", RUNS / 10 * n / (t1-t0) / 1e6, frames);
+    }
+    return errors != 0;
+}
+#endif
@@ -0,0 +1,57 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stddef.h>
+
+// Streaming parser for the device output: console text with embedded
+// in-band frames {<header><payload>}, e.g.
+//     {p<rotation_period_in_us>}
+//     {s<number_of_skipped_columns>}
+//     {c<rotation_counter>}
+//     {r} {a<seq>} {n<seq>} {d<result>}    chunked upload, see upload.h
+// Bytes can be fed in chunks of any size, frames may be split anywhere.
+// A header is a letter, the payload at most TELEMETRY_MAXPAYLOAD printable
+// characters. Anything that breaks these rules is not a frame: the bytes
+// consumed so far are passed on as console text and parsing resumes with
+// the offending byte, so a stray '{' never swallows console output.
+// The parser never allocates memory.
+
+#define TELEMETRY_MAXPAYLOAD 15
+
+struct TelemetryEvent
+{
+    char type;              // 0: console text, otherwise the frame header
+    const char *text;       // console text or frame payload, not terminated
+    unsigned int length;
+    unsigned long value;    // payload as decimal number if numeric
+    bool numeric;
+};
+
+typedef void (*TelemetryHandler)(void *context, const TelemetryEvent& event);
+
+//-----------------------------------------------------------------------------
+  class TelemetryParser
+//-----------------------------------------------------------------------------
+{
+  private:
+    enum { S_TEXT, S_HEADER, S_PAYLOAD } state;
+    char frame[2 + TELEMETRY_MAXPAYLOAD];   // '{', header, payload
+    unsigned int frameLen;
+    unsigned long value;
+    bool numeric;
+    unsigned long badFrames;
+    TelemetryHandler handler;
+    void *context;
+
+    void emitText(const char *text, unsigned int length);
+    void abortFrame(void);
+
+  public:
+    TelemetryParser(TelemetryHandler handler, void *context);
+    void setHandler(TelemetryHandler handler, void *context);
+    void feed(const char *data, size_t length);
+    void reset(void) { state = S_TEXT; };
+    unsigned long getBadFrames(void) { return badFrames; };
+};
+
+#endif
@@ -0,0 +1 @@
+g++ -O2 -Wall -DTELEMETRY_SELFTEST -o telemetry.exe telemetry.cpp
@@ -0,0 +1,365 @@
+#include <stdio.h>      // standard input / output functions
+#include <stdlib.h>
+#include <string.h>     // string function definitions
+#include <unistd.h>     // UNIX standard function definitions
+#include <fcntl.h>      // File control definitions
+#include <errno.h>      // Error number definitions
+#include <termios.h>    // POSIX terminal control definitions
+#include <poll.h>
+#include <sys/uio.h>    // writev()
+#include <sys/ioctl.h>
+
+#ifdef __linux__
+// <asm/termbits.h> clashes with <termios.h>, so termios2 is declared here
+// with the kernel layout (asm-generic)
+#include <asm/ioctls.h> // TCGETS2, TCSETS2
+struct termios2 {
+    tcflag_t c_iflag, c_oflag, c_cflag, c_lflag;
+    cc_t c_line;
+    cc_t c_cc[19];
+    speed_t c_ispeed, c_ospeed;
+};
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+#endif
+
+#include "tty.h"
+
+                
+//-----------------------------------------------------------------------------
+  TTY::TTY(const char *device, int baud, bool hwFlowControl) : rxRate("serial RX"), txRate("serial TX")
+//-----------------------------------------------------------------------------
+{
+    /* Open File Descriptor */  // "/dev/ttyS7"
+
+    handle = open(device , O_RDWR| O_NOCTTY | O_NONBLOCK);
+
+    /* Error Handling */
+    if (handle < 0 )
+    {
+        printf("Error %d\n", errno);
+        exit(1);
+    }
+    
+    /* *** Configure Port *** */
+    memset (&tty, 0, sizeof tty);
+    
+    /* Error Handling */
+    if (tcgetattr(handle, &tty) != 0)
+    {
+        printf("Error %d from tcgetattr: %s\n", errno, strerror(errno));
+        exit(1);
+    }
+    tty_old = tty;
+    
+    /* Setting other Port Stuff */
+    tty.c_cflag     &=  ~PARENB;        // Make 8n1
+    tty.c_cflag     &=  ~CSTOPB;
+    tty.c_cflag     &=  ~CSIZE;
+    tty.c_cflag     |=  CS8;
+
+    if (hwFlowControl)
+        tty.c_cflag |=  CRTSCTS;        // RTS/CTS handshake
+    else
+        tty.c_cflag &=  ~CRTSCTS;       // no flow control
+    //  MIN == 0, TIME == 0 (polling read)
+    //    If data is available, read() returns immediately, with the
+    //    lesser of the number of bytes available, or the number of
+    //    bytes requested.  If no data is available, read(2) returns 0.    
+    //    Waiting for data is done with poll() in fill().
+    tty.c_cc[VMIN]  =  0;               
+    tty.c_cc[VTIME] =  0;               
+    
+    tty.c_cflag     |= CREAD | CLOCAL;  // turn on READ & ignore ctrl lines
+    
+    /* Make raw */
+    cfmakeraw(&tty);
+    
+    /* Flush Port, then applies attributes */
+    tcflush(handle, TCIFLUSH);
+    
+    rxHead = rxTail = 0;
+    rxBytes = rxCalls = 0;
+    txHead = txTail = 0;
+    txBytes = txCalls = 0;
+    baudRate = 0;
+    if (!setBaudRate(baud)) exit(1);
+}
+
+
+//-----------------------------------------------------------------------------
+  bool TTY::setBaudRate(int baud)
+//-----------------------------------------------------------------------------
+// Sends everything queued at the old rate first.
+// Return value: false if the adapter does not support the rate
+{
+    static const struct { int baud; speed_t speed; } rates[] = {
+        { 1200, B1200 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 },
+        { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+        { 115200, B115200 }, { 230400, B230400 },
+#ifdef B460800
+        { 460800, B460800 },
+#endif
+#ifdef B921600
+        { 921600, B921600 },
+#endif
+#ifdef B1000000
+        { 1000000, B1000000 },
+#endif
+#ifdef B1500000
+        { 1500000, B1500000 },
+#endif
+#ifdef B2000000
+        { 2000000, B2000000 },
+#endif
+#ifdef B3000000
+        { 3000000, B3000000 },
+#endif
+    };
+    unsigned int i;
+
+    if (baudRate) {
+        flush(-1);
+        tcdrain(handle);
+    }
+    for (i = 0; i < sizeof rates / sizeof rates[0] && rates[i].baud != baud; i++);
+    if (i < sizeof rates / sizeof rates[0]) {
+        cfsetospeed(&tty, rates[i].speed);
+        cfsetispeed(&tty, rates[i].speed);
+        if (tcsetattr(handle, TCSANOW, &tty) != 0) {
+            printf("Error %d from tcsetattr: %s\n", errno, strerror(errno));
+            return false;
+        }
+        baudRate = baud;
+        return true;
+    }
+#ifdef __linux__
+    struct termios2 tio;
+    if (tcsetattr(handle, TCSANOW, &tty) == 0 && ioctl(handle, TCGETS2, &tio) == 0) {
+        tio.c_cflag &= ~CBAUD;
+        tio.c_cflag |= BOTHER;
+        tio.c_ispeed = tio.c_ospeed = baud;
+        if (ioctl(handle, TCSETS2, &tio) == 0 && ioctl(handle, TCGETS2, &tio) == 0 &&
+            tio.c_ospeed == (speed_t)baud) {
+            baudRate = baud;
+            return true;
+        }
+    }
+#endif
+    printf("Baud rate %d is not supported\n", baud);
+    if (baudRate) setBaudRate(baudRate);        // restore the termios speed
+    return false;
+}
+
+
+//-----------------------------------------------------------------------------
+  void TTY::discardInput(void)
+//-----------------------------------------------------------------------------
+// drop everything received so far, e.g. garbage after a baud rate change
+{
+    tcflush(handle, TCIFLUSH);
+    rxHead = rxTail = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+  TTY::~TTY(void)
+//-----------------------------------------------------------------------------
+{
+    flush(1000);
+    /* restore the former settings */
+    close(handle);
+}
+
+
+//-----------------------------------------------------------------------------
+  int TTY::fill(int timeout_ms)
+//-----------------------------------------------------------------------------
+// Pull everything the driver has into the ring buffer with a single read().
+// Waits up to timeout_ms (-1: forever, 0: don't wait) for the first byte.
+// Return value: number of bytes added
+{
+    unsigned int head, space;
+    int n;
+
+    if (timeout_ms != 0) {
+        struct pollfd pfd;
+        flush(-1);      // the other side can only answer what it received
+        pfd.fd = handle;
+        pfd.events = POLLIN;
+        n = poll(&pfd, 1, timeout_ms);
+        if (n < 0 && errno != EINTR) {
+            printf("Error polling: %s\n", strerror(errno));
+            exit(1);
+        }
+        if (n <= 0) return 0;
+    }
+
+    if (rxHead == rxTail) rxHead = rxTail = 0;     // empty: read into one piece
+    head = rxHead & (TTY_RXBUFSIZE-1);
+    space = TTY_RXBUFSIZE - (rxHead - rxTail);
+    if (space > TTY_RXBUFSIZE - head) space = TTY_RXBUFSIZE - head;
+    if (space == 0) return 0;
+
+    n = read(handle, &rxBuf[head], space);
+    rxCalls++;
+    
+    /* Error Handling */
+    if (n < 0)
+    {
+         if (errno == EAGAIN || errno == EINTR) return 0;
+         printf("Error reading: %s\n", strerror(errno));
+         exit(1);
+    }
+    rxHead += n;
+    rxBytes += n;
+    rxRate.add(n);
+    return n;
+}
+
+
+//-----------------------------------------------------------------------------
+  int TTY::isCharAvailable(void)
+//-----------------------------------------------------------------------------
+{
+    if (rxHead != rxTail) return 1;
+    return fill(0) > 0;
+}
+
+
+//-----------------------------------------------------------------------------
+  int TTY::getChar(int timeout_ms)
+//-----------------------------------------------------------------------------
+// Return value: next received character or -1 after timeout_ms without data
+{
+    if (rxHead == rxTail && fill(timeout_ms) == 0) return -1;
+    return rxBuf[rxTail++ & (TTY_RXBUFSIZE-1)];
+}
+
+
+//-----------------------------------------------------------------------------
+  int TTY::getChar(void)
+//-----------------------------------------------------------------------------
+{
+    while (rxHead == rxTail)
+        fill(-1);
+    return rxBuf[rxTail++ & (TTY_RXBUFSIZE-1)];
+}
+
+
+//-----------------------------------------------------------------------------
+  unsigned int TTY::getData(unsigned char *data, unsigned int size)
+//-----------------------------------------------------------------------------
+// Copy up to size received bytes without waiting.
+// Return value: number of bytes copied
+{
+    unsigned int n, tail, first;
+
+    if (rxHead == rxTail) fill(0);
+    n = rxHead - rxTail;
+    if (n > size) n = size;
+    tail = rxTail & (TTY_RXBUFSIZE-1);
+    first = n < TTY_RXBUFSIZE - tail ? n : TTY_RXBUFSIZE - tail;
+    memcpy(data, &rxBuf[tail], first);
+    memcpy(data + first, &rxBuf[0], n - first);
+    rxTail += n;
+    return n;
+}
+
+
+//-----------------------------------------------------------------------------
+  void TTY::putChar(char ch)
+//-----------------------------------------------------------------------------
+{
+    if (txHead - txTail == TTY_TXBUFSIZE) flush(-1);
+    txBuf[txHead++ & (TTY_TXBUFSIZE-1)] = ch;
+}
+
+
+//-----------------------------------------------------------------------------
+  void TTY::putData(unsigned char *data, size_t size)
+//-----------------------------------------------------------------------------
+{
+#if 0
+    size_t i;
+    for (i=0; i<size; i++) {
+        printf("%02X", data[i]);
+        if ((i&63)==63) printf("\n");
+    }
+    printf("\n");
+#endif
+    while (size > 0) {
+        unsigned int head = txHead & (TTY_TXBUFSIZE-1);
+        unsigned int n = TTY_TXBUFSIZE - (txHead - txTail);
+        if (n > TTY_TXBUFSIZE - head) n = TTY_TXBUFSIZE - head;
+        if (n > size) n = size;
+        if (n == 0) {
+            flush(-1);
+            continue;
+        }
+        memcpy(&txBuf[head], data, n);
+        txHead += n;
+        data += n;
+        size -= n;
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+  unsigned int TTY::flush(int timeout_ms)
+//-----------------------------------------------------------------------------
+// Write the queued bytes with as few writev() calls as the driver allows.
+// Partial writes are completed; when the driver buffer is full, wait up to
+// timeout_ms (-1: forever, 0: don't wait) for it to drain.
+// Return value: number of bytes still queued
+{
+    while (txHead != txTail) {
+        struct iovec iov[2];
+        unsigned int tail = txTail & (TTY_TXBUFSIZE-1);
+        unsigned int pending = txHead - txTail;
+        int cnt = 1;
+        ssize_t n;
+
+        iov[0].iov_base = &txBuf[tail];
+        iov[0].iov_len = pending;
+        if (tail + pending > TTY_TXBUFSIZE) {   // wrapped around
+            iov[0].iov_len = TTY_TXBUFSIZE - tail;
+            iov[1].iov_base = &txBuf[0];
+            iov[1].iov_len = pending - iov[0].iov_len;
+            cnt = 2;
+        }
+
+        n = writev(handle, iov, cnt);
+        txCalls++;
+        if (n > 0) {
+            txTail += n;
+            txBytes += n;
+            txRate.add(n);
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            printf("BT write error: %s\n", strerror(errno));
+            exit(1);
+        }
+        if (timeout_ms == 0) break;
+
+        struct pollfd pfd;
+        pfd.fd = handle;
+        pfd.events = POLLOUT;
+        if (poll(&pfd, 1, timeout_ms) == 0) break;
+    }
+    if (txHead == txTail) txHead = txTail = 0;
+    return txHead - txTail;
+}
+
+
+//-----------------------------------------------------------------------------
+  void TTY::printStats(void)
+//-----------------------------------------------------------------------------
+{
+    printf("Serial RX: %lu bytes in %lu read() calls (%.1f bytes/call)\n",
+           rxBytes, rxCalls, rxCalls ? (double)rxBytes / rxCalls : 0.);
+    printf("Serial TX: %lu bytes in %lu writev() calls (%.1f bytes/call)\n",
+           txBytes, txCalls, txCalls ? (double)txBytes / txCalls : 0.);
+}
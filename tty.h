@@ -0,0 +1,62 @@
+#ifndef TTY_H
+#define TTY_H
+
+#include <stddef.h>
+#include <termios.h>
+
+#include "stats.h"
+
+#define TTY_RXBUFSIZE 4096      // must be a power of 2
+#define TTY_TXBUFSIZE 4096      // must be a power of 2
+#define TTY_DEFAULT_BAUD 9600
+
+// Baud rate change on the device: 'B', prompt "...]: ", rate + CR, the
+// device answers "...baud\n" and switches. Unless a CR arrives at the new
+// rate within TTY_BAUD_CONFIRM_MS it falls back to the previous rate.
+#define TTY_BAUD_CONFIRM_MS 2000
+
+//-----------------------------------------------------------------------------
+  class TTY {
+//-----------------------------------------------------------------------------
+// Serial link to the POV cylinder. Received bytes are pulled from the driver
+// in bulk into a ring buffer; getChar() is served from that buffer and only
+// enters the kernel when it runs empty. Transmitted bytes are queued and
+// written with writev() on flush(), i.e. before waiting for a response, when
+// the queue is full or when the main loop is idle. The descriptor is
+// non-blocking, so a full driver buffer never drops data.
+// Any baud rate the adapter supports can be set: the standard Bxxx rates
+// through termios, others through termios2/BOTHER (Linux only).
+
+private: 
+    int handle;
+    struct termios tty, tty_old;    
+    unsigned char rxBuf[TTY_RXBUFSIZE];
+    unsigned int rxHead, rxTail;        // free running ring buffer indices
+    unsigned long rxBytes, rxCalls;     // statistics: bytes per read() call
+    unsigned char txBuf[TTY_TXBUFSIZE];
+    unsigned int txHead, txTail;
+    unsigned long txBytes, txCalls;     // statistics: bytes per writev() call
+    int baudRate;
+    Throughput rxRate, txRate;
+    int fill(int timeout_ms);
+
+public:
+    TTY(const char *device, int baud = TTY_DEFAULT_BAUD, bool hwFlowControl = false);
+   ~TTY(void);
+    int isCharAvailable(void);
+    int getChar(void);
+    int getChar(int timeout_ms);
+    unsigned int getData(unsigned char *data, unsigned int size);
+    unsigned int getBufferedCount(void) { return rxHead - rxTail; };
+    void putChar(char ch);
+    void putData(unsigned char *data, size_t size);
+    unsigned int flush(int timeout_ms = -1);
+    unsigned int getPendingCount(void) { return txHead - txTail; };
+    int getHandle(void) { return handle; };
+    bool setBaudRate(int baud);
+    int getBaudRate(void) { return baudRate; };
+    void discardInput(void);
+    void printStats(void);
+};
+
+#endif
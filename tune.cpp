@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <math.h>
+
+#include "tune.h"
+#include "motor.h"
+#include "stats.h"
+
+
+//-----------------------------------------------------------------------------
+  SpeedTuner::SpeedTuner(Motor& motor, const char *tag) : motor(motor), tag(tag)
+//-----------------------------------------------------------------------------
+{
+    nShows = 0;
+    replace = 0;
+    current = NULL;
+    state = TUNE_IDLE;
+    freq = 0;
+    clean = 0;
+    descending = false;
+    cleanSince = 0;
+    inBand = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+  void SpeedTuner::setFreq(double f)
+//-----------------------------------------------------------------------------
+{
+    freq = f < TUNE_MINFREQ ? TUNE_MINFREQ : f > TUNE_MAXFREQ ? TUNE_MAXFREQ : f;
+    motor.warmStart(freq);
+    cleanSince = now_ms();
+    inBand = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+  void SpeedTuner::hold(double edge)
+//-----------------------------------------------------------------------------
+{
+    current->edge = edge;
+    current->tuned = true;
+    state = TUNE_HOLD;
+    setFreq(edge - TUNE_MARGIN);
+    printf("\n%sAuto-tune: no skipped columns up to %.1f Hz - running at %.1f Hz\n", tag, edge, freq);
+}
+
+
+//-----------------------------------------------------------------------------
+  void SpeedTuner::showStarted(unsigned long long key)
+//-----------------------------------------------------------------------------
+// a new show is on display; the same one again changes nothing
+{
+    int i;
+
+    if (current && current->key == key) return;
+    if (state == TUNE_SEARCH) current->edge = clean;    // resumed when the show comes back
+    if (key == 0) {
+        current = NULL;
+        state = TUNE_IDLE;
+        return;
+    }
+    for (i = 0; i < nShows && shows[i].key != key; i++);
+    if (i < nShows && shows[i].tuned) {
+        current = &shows[i];
+        state = TUNE_HOLD;
+        setFreq(current->edge - TUNE_MARGIN);
+        printf("\n%sAuto-tune: known show - running at %.1f Hz\n", tag, freq);
+        return;
+    }
+    state = TUNE_SEARCH;
+    descending = false;
+    if (i < nShows) {
+        current = &shows[i];
+        clean = current->edge;
+        setFreq(clean > 0 ? clean : motor.getWantedFreq());
+        printf("\n%sAuto-tune: searching on from %.1f Hz\n", tag, freq);
+        return;
+    }
+    if (nShows < TUNE_MAXSHOWS) i = nShows++;
+    else {
+        i = replace;
+        replace = (replace + 1) % TUNE_MAXSHOWS;
+    }
+    current = &shows[i];
+    current->key = key;
+    current->edge = 0;
+    current->tuned = false;
+    clean = 0;
+    setFreq(motor.getWantedFreq());
+    printf("\n%sAuto-tune: new show - searching from %.1f Hz\n", tag, freq);
+}
+
+
+//-----------------------------------------------------------------------------
+  void SpeedTuner::rotationPeriod(unsigned int period)
+//-----------------------------------------------------------------------------
+// every {p} report
+{
+    if (period > 0 && fabs(1e6 / period - freq) <= TUNE_SETTLE_BAND) inBand++;
+    else inBand = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+  void SpeedTuner::skippedColumns(unsigned int n)
+//-----------------------------------------------------------------------------
+// every {s} report
+{
+    long long t = now_ms();
+
+    if (state == TUNE_IDLE) return;
+    if (n > 0) {
+        cleanSince = t;
+        if (!isSettled()) return;                               // speed still changing
+        if (state == TUNE_SEARCH && clean > 0) hold(clean);     // one step too far
+        else if (state == TUNE_SEARCH) {
+            descending = true;
+            if (freq > TUNE_MINFREQ) setFreq(freq - TUNE_STEP);
+            else {
+                printf("\n%sAuto-tune: columns skipped even at %.1f Hz\n", tag, freq);
+                hold(TUNE_MINFREQ + TUNE_MARGIN);
+            }
+        }
+        else if (current->edge - TUNE_MARGIN > TUNE_MINFREQ) {
+            current->edge -= TUNE_STEP;
+            printf("\n%sAuto-tune: columns skipped at %.1f Hz - lowering to %.1f Hz\n", tag, freq, current->edge - TUNE_MARGIN);
+            setFreq(current->edge - TUNE_MARGIN);
+        }
+        return;
+    }
+
+    // a frequency counts as clean once the motor has run at it long enough
+    if (!isSettled()) {
+        cleanSince = t;
+        return;
+    }
+    if (state == TUNE_SEARCH && t - cleanSince >= TUNE_DWELL_MS) {
+        clean = freq;
+        if (descending || freq >= TUNE_MAXFREQ) hold(freq);
+        else setFreq(freq + TUNE_STEP);
+    }
+    else if (state == TUNE_HOLD && t - cleanSince >= TUNE_RETRY_MS) {
+        // conditions may have improved: probe one step above the edge
+        state = TUNE_SEARCH;
+        descending = false;
+        clean = current->edge;
+        setFreq(current->edge + TUNE_STEP);
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+  const char *SpeedTuner::getStateName(void)
+//-----------------------------------------------------------------------------
+{
+    switch (state) {
+        case TUNE_SEARCH: return "searching";
+        case TUNE_HOLD:   return "holding";
+        default:          return "idle";
+    }
+}
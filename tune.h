@@ -0,0 +1,79 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+// Display quality auto-tune (-T).
+//
+// A faster cylinder gives a steadier picture until the display firmware
+// runs out of time per column and skips columns ({s}). How fast it can go
+// depends on the picture, so the tuner finds the highest wanted motor
+// frequency without skipped columns for every show on its own:
+//   - search: once the motor has settled at a frequency and TUNE_DWELL_MS
+//     passed without skipped columns, the frequency goes up by TUNE_STEP;
+//     settled means TUNE_SETTLE_SAMPLES rotation periods in a row within
+//     TUNE_SETTLE_BAND, which the step controller reaches as well as PID,
+//     skips before any clean frequency was found make it go down instead,
+//   - the edge of a show is its highest clean frequency. It runs
+//     TUNE_MARGIN below it, so the cylinder does not hover at the limit,
+//   - hold: a show that was tuned before starts right at its frequency.
+//     If columns are skipped anyway (supply voltage, temperature) the edge
+//     goes down by TUNE_STEP; after TUNE_RETRY_MS without skips the next
+//     step up is tried again.
+// The tuner sets the wanted frequency of the automatic motor control, each
+// change starting at the duty cycle learned for it (Motor::warmStart()).
+
+#define TUNE_STEP           0.5         // Hz
+#define TUNE_MARGIN         0.5         // Hz below the edge
+#define TUNE_MINFREQ        8.0         // Hz
+#define TUNE_MAXFREQ        30.0        // Hz
+#define TUNE_DWELL_MS       3000
+#define TUNE_SETTLE_BAND    0.2         // Hz around the frequency under test
+#define TUNE_SETTLE_SAMPLES 6           // {p} reports, 3 s at the default rate
+#define TUNE_RETRY_MS       300000
+#define TUNE_MAXSHOWS       64          // remembered edges, the oldest is replaced
+
+// what is shown; 0: unknown, not tuned
+#define TUNE_KEY_INTERNAL(index)    ((1ULL << 48) | (unsigned int)(index))
+#define TUNE_KEY_FILE(crc, size)    (((unsigned long long)(crc) << 32) | ((size) & 0xFFFFFFFFULL))
+#define TUNE_KEY_STREAM             (2ULL << 48)
+
+class Motor;
+
+//-----------------------------------------------------------------------------
+  class SpeedTuner
+//-----------------------------------------------------------------------------
+{
+  private:
+    enum State { TUNE_IDLE, TUNE_SEARCH, TUNE_HOLD };
+    struct Show {
+        unsigned long long key;
+        double edge;                // Hz, highest frequency without skips, 0: none yet
+        bool tuned;                 // false: search not finished, edge so far
+    };
+
+    Motor &motor;
+    const char *tag;                // in front of messages, e.g. "[left] "
+    Show shows[TUNE_MAXSHOWS];
+    int nShows;
+    int replace;                    // next entry to reuse when the table is full
+    Show *current;
+    State state;
+    double freq;                    // Hz, frequency under test or running
+    double clean;                   // Hz, highest clean one of this search, 0: none
+    bool descending;                // search went down: the first clean one is the edge
+    long long cleanSince;           // ms, start of the current run without skips
+    int inBand;                     // {p} reports in a row near freq
+
+    void setFreq(double f);
+    void hold(double edge);
+    bool isSettled(void) { return inBand >= TUNE_SETTLE_SAMPLES; };
+
+  public:
+    SpeedTuner(Motor& motor, const char *tag = "");
+    void showStarted(unsigned long long key);
+    void rotationPeriod(unsigned int period);
+    void skippedColumns(unsigned int n);
+    const char *getStateName(void);
+    double getFreq(void) { return freq; };
+};
+
+#endif
@@ -0,0 +1,33 @@
+# Test of the auto-tune (tune.h) with the default step speed controller
+# against povsim: the simulated display skips columns above 17.2 Hz, so the
+# search from 16 Hz has to find 17 Hz as the edge and run the show at 16.5 Hz.
+g++ -g -Wall -o pccp.exe pccp.cpp tty.cpp motor.cpp command.cpp crc.cpp upload.cpp telemetry.cpp recorder.cpp stats.cpp gif.cpp playlist.cpp expect.cpp device.cpp server.cpp stream.cpp tune.cpp preflight.cpp || exit 1
+g++ -g -Wall -o povsim.exe povsim.cpp crc.cpp -lpthread -lm || exit 1
+
+# 1x1 GIF, shown for the whole test
+printf 'GIF89a\001\000\001\000\200\000\000\377\377\377\000\000\000!\371\004\001\000\000\000\000,\000\000\000\000\001\000\001\000\000\002\002D\001\000;' > tune-test.gif
+printf '600 tune-test.gif\n' > tune-test.txt
+rm -f tune-test.duty
+
+./povsim.exe -b 115200 -m 5879 -K 17.2 > tune-povsim.log &
+sim=$!
+sleep 1
+dev=$(sed -n 's/^POV cylinder simulator on //p' tune-povsim.log)
+./pccp.exe -t "$dev" -b 115200 -m localhost:5879 -T -D tune-test.duty -l tune-test.txt < /dev/null > tune-pccp.log &
+pccp=$!
+# a search step takes a few seconds; give up after two minutes
+for i in $(seq 120); do
+    grep -qa "Auto-tune: no skipped columns" tune-pccp.log && break
+    sleep 1
+done
+kill $pccp $sim
+wait $pccp $sim 2> /dev/null
+
+rm -f tune-test.gif tune-test.txt tune-test.duty
+if grep -qa "Auto-tune: no skipped columns up to 17.0 Hz - running at 16.5 Hz" tune-pccp.log; then
+    echo "tune.sh: ok (${i} s)"
+    rm -f tune-povsim.log tune-pccp.log
+else
+    echo "tune.sh: FAILED - no edge at 17.0 Hz found, see tune-pccp.log"
+    exit 1
+fi
@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "tty.h"
+#include "crc.h"
+#include "upload.h"
+#include "stats.h"
+
+
+//-----------------------------------------------------------------------------
+  ChunkedUpload::ChunkedUpload(TTY& tty, const char *tag) : bt(tty), tag(tag)
+//-----------------------------------------------------------------------------
+{
+    state = U_IDLE;
+    result = UPLOAD_ERROR;
+    fd = -1;
+    data = NULL;
+}
+
+
+//-----------------------------------------------------------------------------
+  ChunkedUpload::~ChunkedUpload(void)
+//-----------------------------------------------------------------------------
+{
+    if (fd >= 0) close(fd);
+}
+
+
+//-----------------------------------------------------------------------------
+  bool ChunkedUpload::begin(const char *fileName)
+//-----------------------------------------------------------------------------
+// Return value: false if the file cannot be sent
+{
+    struct stat st;
+
+    cancel();
+    fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+        printf("Command aborted - File '%s' not found\n", fileName);
+        return false;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+        (unsigned long long)st.st_size > 0xFFFFFFFFULL) {
+        printf("Command aborted - Error reading file\n");
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    return start(fileName, st.st_size);
+}
+
+
+//-----------------------------------------------------------------------------
+  bool ChunkedUpload::begin(const char *name, const unsigned char *data, size_t size)
+//-----------------------------------------------------------------------------
+// name: for messages
+{
+    cancel();
+    if (size == 0 || (unsigned long long)size > 0xFFFFFFFFULL) {
+        printf("Command aborted - Error reading file\n");
+        return false;
+    }
+    this->data = data;
+    return start(name, size);
+}
+
+
+//-----------------------------------------------------------------------------
+  bool ChunkedUpload::start(const char *name, size_t size)
+//-----------------------------------------------------------------------------
+{
+    this->size = size;
+    nChunks = (size + UPLOAD_CHUNKSIZE - 1) / UPLOAD_CHUNKSIZE;
+    strncpy(this->name, name, sizeof this->name - 1);
+    this->name[sizeof this->name - 1] = 0;
+
+    // handshake, the start line is repeated in case it got lost
+    state = U_START;
+    result = UPLOAD_BUSY;
+    tries = 0;
+    deadline = 0;
+    poll();
+    return true;
+}
+
+
+//-----------------------------------------------------------------------------
+  void ChunkedUpload::finish(int r)
+//-----------------------------------------------------------------------------
+{
+    if (fd >= 0) close(fd);
+    fd = -1;
+    data = NULL;
+    state = U_IDLE;
+    result = r;
+}
+
+
+//-----------------------------------------------------------------------------
+  void ChunkedUpload::cancel(void)
+//-----------------------------------------------------------------------------
+{
+    if (state != U_IDLE) finish(UPLOAD_ERROR);
+}
+
+
+//-----------------------------------------------------------------------------
+  bool ChunkedUpload::sendChunk(unsigned long seq)
+//-----------------------------------------------------------------------------
+// Return value: false if the TX ring has no room for it yet
+{
+    unsigned char frame[5 + UPLOAD_MAXCHUNKSIZE + 2];
+    unsigned int len = seq == nChunks-1 ? size - seq * UPLOAD_CHUNKSIZE : UPLOAD_CHUNKSIZE;
+    unsigned short chunkCrc;
+
+    if (bt.getPendingCount() + 7 + len > TTY_TXBUFSIZE) return false;
+    if (data) memcpy(&frame[5], data + seq * UPLOAD_CHUNKSIZE, len);
+    else if (pread(fd, &frame[5], len, (off_t)seq * UPLOAD_CHUNKSIZE) != (ssize_t)len) {
+        printf("%sUpload aborted - Error reading file\n", tag);
+        finish(UPLOAD_ERROR);
+        return false;
+    }
+    if (seq == crcChunks) {     // first transmissions go out in order
+        fileCrc = crc_update(fileCrc, &frame[5], len);
+        crcChunks++;
+    }
+    frame[0] = UPLOAD_STX;
+    frame[1] = seq;
+    frame[2] = seq >> 8;
+    frame[3] = len;
+    frame[4] = len >> 8;
+    chunkCrc = crc_finish(crc_update(crc_init(), &frame[1], 4 + len));
+    frame[5+len] = chunkCrc;
+    frame[6+len] = chunkCrc >> 8;
+    bt.putData(frame, 7 + len);
+    return true;
+}
+
+
+//-----------------------------------------------------------------------------
+  void ChunkedUpload::sendEnd(void)
+//-----------------------------------------------------------------------------
+{
+    unsigned char frame[5];
+
+    frame[0] = UPLOAD_EOT;
+    frame[1] = fileCrc;
+    frame[2] = fileCrc >> 8;
+    frame[3] = ~frame[1];
+    frame[4] = ~frame[2];
+    bt.putData(frame, 5);
+    tries++;
+    deadline = now_ms() + UPLOAD_ACK_TIMEOUT_MS;
+}
+
+
+//-----------------------------------------------------------------------------
+  void ChunkedUpload::poll(void)
+//-----------------------------------------------------------------------------
+// send whatever is due now
+{
+    long long t = now_ms();
+    unsigned long seq;
+    char start[48];
+
+    switch (state) {
+        case U_IDLE:
+            break;
+
+        case U_START:
+            if (t < deadline) break;
+            if (tries++ == 3) {
+                finish(UPLOAD_NOT_SUPPORTED);
+                break;
+            }
+            sprintf(start, "%%%lu,%u,%u\r", size, UPLOAD_CHUNKSIZE, UPLOAD_WINDOW);
+            bt.putData((unsigned char *)start, strlen(start));
+            deadline = t + UPLOAD_READY_TIMEOUT_MS;
+            break;
+
+        case U_CHUNKS:
+            // (re)send every chunk in the window that is new, rejected or overdue
+            for (seq = base; seq < base + UPLOAD_WINDOW && seq < nChunks; seq++) {
+                int slot = seq % UPLOAD_WINDOW;
+
+                if (acked[slot]) continue;
+                if (sentAt[slot] && !nak[slot] && t < sentAt[slot] + UPLOAD_ACK_TIMEOUT_MS) continue;
+                if (sentAt[slot] && retries[slot] == UPLOAD_MAXRETRIES) {
+                    printf("%sUpload aborted - chunk %lu not acknowledged\n", tag, seq);
+                    finish(UPLOAD_ERROR);
+                    return;
+                }
+                if (!sendChunk(seq)) return;    // the rest when the ring has room
+                if (sentAt[slot]) {
+                    resent++;
+                    retries[slot]++;
+                }
+                sentAt[slot] = t;
+                nak[slot] = false;
+            }
+            break;
+
+        case U_END:
+            if (t < deadline) break;
+            if (tries == UPLOAD_MAXRETRIES) {
+                printf("%sUpload aborted - no final acknowledge\n", tag);
+                finish(UPLOAD_ERROR);
+                break;
+            }
+            sendEnd();
+            break;
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+  void ChunkedUpload::reply(char header, unsigned long value)
+//-----------------------------------------------------------------------------
+// an upload frame from the device
+{
+    unsigned long seq;
+    int i;
+
+    switch (state) {
+        case U_IDLE:
+            break;
+
+        case U_START:
+            if (header != 'r') break;
+            printf("%sDownloading file %s - %lu bytes in %lu chunks\n", tag, name, size, nChunks);
+            for (i = 0; i < UPLOAD_WINDOW; i++) {
+                sentAt[i] = 0;
+                retries[i] = 0;
+                acked[i] = false;
+                nak[i] = false;
+            }
+            base = crcChunks = resent = 0;
+            fileCrc = crc_init();
+            state = U_CHUNKS;
+            poll();
+            break;
+
+        case U_CHUNKS:
+            if (header != 'a' && header != 'n') break;
+            seq = base + ((value - base) & 0xFFFF);    // undo modulo 65536
+            if (seq >= base + UPLOAD_WINDOW || seq >= nChunks) break;
+            if (header == 'a') acked[seq % UPLOAD_WINDOW] = true;
+            else nak[seq % UPLOAD_WINDOW] = true;
+
+            while (base < nChunks && acked[base % UPLOAD_WINDOW]) {
+                int slot = base % UPLOAD_WINDOW;
+                acked[slot] = false;
+                nak[slot] = false;
+                sentAt[slot] = 0;
+                retries[slot] = 0;
+                base++;
+            }
+            if (base < nChunks) {
+                poll();
+                break;
+            }
+            fileCrc = crc_finish(fileCrc);
+            if (fd >= 0) close(fd);
+            fd = -1;
+            state = U_END;
+            tries = 0;
+            sendEnd();
+            break;
+
+        case U_END:
+            if (header != 'd') break;
+            printf("%sCRC: 0x%04X %s - %lu chunks resent\n", tag, fileCrc, value == 0 ? "ok" : "ERROR", resent);
+            finish(value == 0 ? UPLOAD_OK : UPLOAD_ERROR);
+            break;
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+  int ChunkedUpload::getTimeout(void)
+//-----------------------------------------------------------------------------
+// Return value: ms until poll() has something to do, -1: nothing to wait for
+// (a chunk waiting for room in the TX ring is sent when the link becomes
+// writable, the main loop polls it with POLLOUT)
+{
+    long long t = now_ms(), next = -1;
+    unsigned long seq;
+
+    switch (state) {
+        case U_IDLE:
+            return -1;
+
+        case U_START:
+        case U_END:
+            next = deadline;
+            break;
+
+        case U_CHUNKS:
+            for (seq = base; seq < base + UPLOAD_WINDOW && seq < nChunks; seq++) {
+                int slot = seq % UPLOAD_WINDOW;
+                long long due;
+
+                if (acked[slot]) continue;
+                if (sentAt[slot] == 0 || nak[slot]) {
+                    if (bt.getPendingCount() == 0) return 0;
+                    continue;
+                }
+                due = sentAt[slot] + UPLOAD_ACK_TIMEOUT_MS;
+                if (next < 0 || due < next) next = due;
+            }
+            if (next < 0) return -1;
+            break;
+    }
+    return next > t ? (int)(next - t) : 0;
+}
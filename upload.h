@@ -0,0 +1,90 @@
+// Chunked upload protocol ('%' format)
+//
+// The legacy '&' format sends the whole file as one blob with a single CRC;
+// one lost byte means the complete transfer has to be repeated. The chunked
+// format splits the file into numbered chunks with their own CRC, keeps up
+// to a window of chunks in flight and only repeats the failed ones.
+//
+// host:   "%<size>,<chunksize>,<window>\r"     ASCII, never contains '&'
+// device: {r}                                 ready (no answer: legacy firmware)
+// host:   STX seq[2] len[2] data[len] crc[2]  crc over seq, len and data
+// device: {a<seq>}                            chunk stored
+//         {n<seq>}                            chunk rejected, send again
+// host:   EOT crc[2] ~crc[2]                  all chunks acknowledged, crc of file
+// device: {d0} / {d1}                         file ok / file crc error
+//
+// All binary fields are little endian, seq counts modulo 65536. The
+// device answers in its normal console stream as in-band {x..} frames.
+
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#define UPLOAD_STX              0x02
+#define UPLOAD_EOT              0x04
+#define UPLOAD_CHUNKSIZE        256
+#define UPLOAD_WINDOW           8
+#define UPLOAD_MAXWINDOW        32
+#define UPLOAD_MAXCHUNKSIZE     1024
+#define UPLOAD_READY_TIMEOUT_MS 1000    // per start line, sent up to 3 times
+#define UPLOAD_ACK_TIMEOUT_MS   3000
+#define UPLOAD_MAXRETRIES       8
+
+// results of ChunkedUpload
+#define UPLOAD_BUSY             1
+#define UPLOAD_OK               0
+#define UPLOAD_ERROR            (-1)    // file or transfer error
+#define UPLOAD_NOT_SUPPORTED    (-2)    // no {r}: use the '&' format
+
+class TTY;
+
+//-----------------------------------------------------------------------------
+  class ChunkedUpload
+//-----------------------------------------------------------------------------
+// One '%' transfer as a state machine that never waits: begin() sends the
+// start line, the device's {r} {a..} {n..} {d..} frames go to reply(),
+// poll() sends what is due (new, rejected or overdue chunks, repeated
+// start lines and EOTs) and getTimeout() tells the main loop when that
+// is. A chunk is only queued when the TX ring has room for it.
+// The file is read from disk or taken from memory; memory has to stay
+// unchanged until the upload is over.
+{
+  private:
+    enum State { U_IDLE, U_START, U_CHUNKS, U_END };
+
+    TTY &bt;
+    const char *tag;                // in front of messages
+    State state;
+    int result;
+    int fd;
+    const unsigned char *data;      // file in memory, NULL: fd
+    char name[256];                 // for messages
+    unsigned long size, nChunks;
+    unsigned long base;             // oldest chunk not acknowledged
+    unsigned long crcChunks;        // chunks in the file CRC so far
+    unsigned long resent;
+    unsigned short fileCrc;
+    int tries;                      // start lines or EOTs sent
+    long long deadline;             // ms, next start line or EOT
+    long long sentAt[UPLOAD_MAXWINDOW];     // per window slot, 0: not sent yet
+    bool nak[UPLOAD_MAXWINDOW];             // rejected by the device: send now
+    int retries[UPLOAD_MAXWINDOW];
+    bool acked[UPLOAD_MAXWINDOW];
+
+    bool start(const char *name, size_t size);
+    bool sendChunk(unsigned long seq);
+    void sendEnd(void);
+    void finish(int r);
+
+  public:
+    ChunkedUpload(TTY& tty, const char *tag = "");
+   ~ChunkedUpload(void);
+    bool begin(const char *fileName);
+    bool begin(const char *name, const unsigned char *data, size_t size);
+    void reply(char header, unsigned long value);
+    void poll(void);
+    int getTimeout(void);
+    int getResult(void) { return result; };
+    void cancel(void);
+};
+
+#endif